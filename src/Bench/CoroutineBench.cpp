@@ -0,0 +1,149 @@
+// build with cmake -DVOD_BENCHMARKS=ON -DCMAKE_BUILD_TYPE=Release, runs as bin/VOD_CoroutineBench
+// compares handing frames to the coroutine of a connection with calling a handler directly
+// uses Connections (src/Objects/Connections.h) like the server does
+// then checks sleepFor, frames that arrive during a sleep are queued in order and a closed sleeping connection cancels its timer
+// exits with 1 if a check fails
+
+#include "Objects/Task.h"
+#include "Objects/Connections.h"
+
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstdlib>
+#include <new>
+#include <stdio.h>
+
+static uint64_t _allocations = 0;
+
+void* operator new(size_t size) {
+	_allocations++;
+	if (void* p = malloc(size))
+		return p;
+	throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+namespace {
+	struct BenchPacket {
+		int value = 0;
+	};
+
+	using Frame = Connections<BenchPacket>::Frame;
+	using Connection = Connections<BenchPacket>::Connection;
+
+	TimingWheel _timers;
+	Connections<BenchPacket> _connections = { _timers };
+	uint64_t _handled = 0; // sum of the frame types, so the work can't be optimized away
+
+	void handleFrame(const Frame& frame) {
+		_handled += frame.type;
+	}
+
+	Task handleConnection(uint32_t id) {
+		auto guard = _connections.guard(id);
+		Connection& connection = *_connections.find(id);
+		while (true) {
+			Frame frame = co_await _connections.recvFrame(connection);
+			if (!frame.spPacket) // closed
+				co_return;
+			handleFrame(frame);
+		}
+	}
+
+	// the callback path, the same lookup but the handler is called directly
+	void dispatchFrame(uint32_t id, Frame frame) {
+		if (!_connections.find(id))
+			return;
+		handleFrame(frame);
+	}
+
+	// sleeps for ms after its first frame, then records the types of the following frames
+	Task sleepingConnection(uint32_t id, uint64_t ms, std::vector<int>& types) {
+		auto guard = _connections.guard(id);
+		Connection& connection = *_connections.find(id);
+		Frame frame = co_await _connections.recvFrame(connection);
+		if (!frame.spPacket)
+			co_return;
+		types.push_back(frame.type);
+		co_await _connections.sleepFor(connection, ms);
+		while (true) {
+			frame = co_await _connections.recvFrame(connection);
+			if (!frame.spPacket)
+				co_return;
+			types.push_back(frame.type);
+		}
+	}
+
+	int checkSleep(const std::shared_ptr<BenchPacket>& spPacket) {
+		int errors = 0;
+		std::vector<int> types;
+		_connections.open(1);
+		sleepingConnection(1, 10, types);
+		_connections.deliverFrame(1, { 1, spPacket });
+		_connections.deliverFrame(1, { 2, spPacket }); // queued while it sleeps
+		_connections.deliverFrame(1, { 3, spPacket });
+		_timers.advance(_timers.now() + 9);
+		if (types != std::vector<int>{ 1 })
+			errors++;
+		_timers.advance(_timers.now() + 1);
+		_connections.deliverFrame(1, { 4, spPacket });
+		if (types != std::vector<int>{ 1, 2, 3, 4 })
+			errors++;
+		_connections.deliverFrame(1, {});
+		if (_connections.find(1))
+			errors++;
+
+		std::vector<int> closedTypes;
+		_connections.open(2);
+		sleepingConnection(2, 10, closedTypes);
+		_connections.deliverFrame(2, { 1, spPacket });
+		_connections.close(2); // destroys the sleeping coroutine, its guard cancels the timer
+		if (_connections.find(2) || _timers.size() != 0)
+			errors++;
+		_timers.advance(_timers.now() + 10);
+		if (closedTypes != std::vector<int>{ 1 })
+			errors++;
+
+		printf("sleepFor: %d wrong\n", errors);
+		return errors;
+	}
+}
+
+int main() {
+	const uint32_t connectionCount = 1000;
+	const uint64_t frameCount = 20000000;
+	auto spPacket = std::make_shared<BenchPacket>(); // frames share it, like the server shares a packet between its handlers
+
+	for (uint32_t id = 0; id < connectionCount; id++) {
+		_connections.open(id);
+		handleConnection(id);
+	}
+
+	uint64_t allocations = _allocations;
+	auto start = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < frameCount; i++)
+		_connections.deliverFrame((uint32_t)(i % connectionCount), { 1 + (int)(i & 3), spPacket });
+	double coroutineNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / frameCount;
+	uint64_t coroutineAllocations = _allocations - allocations;
+
+	allocations = _allocations;
+	start = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < frameCount; i++)
+		dispatchFrame((uint32_t)(i % connectionCount), { 1 + (int)(i & 3), spPacket });
+	double callbackNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / frameCount;
+	uint64_t callbackAllocations = _allocations - allocations;
+
+	for (uint32_t id = 0; id < connectionCount; id++) // ends the coroutines
+		_connections.deliverFrame(id, {});
+
+	printf("%u connections, %llu frames\n", connectionCount, (unsigned long long)frameCount);
+	printf("coroutine resume: %.1f ns/frame, %llu allocations\n", coroutineNs, (unsigned long long)coroutineAllocations);
+	printf("direct callback:  %.1f ns/frame, %llu allocations\n", callbackNs, (unsigned long long)callbackAllocations);
+	printf("(checksum %llu)\n", (unsigned long long)_handled);
+
+	int errors = _connections.size() != 0 ? 1 : 0;
+	errors += checkSleep(spPacket);
+	return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+// build with cmake -DVOD_BENCHMARKS=ON -DCMAKE_BUILD_TYPE=Release, runs as bin/VOD_LatencyBench [port] [moves], linux only
+// measures the relay latency of moves over loopback, with the default profile and with --low-latency
+// starts bin/VOD_Server for each profile, alice sends a move and waits until bob received it, then the next after a pause
+// the pause is 100us and 1ms, to see how the spin budget of the low latency profile adapts to the traffic
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+namespace {
+	struct Client {
+		int stream = -1;
+		int dgram = -1;
+	};
+
+	std::string packet(uint32_t type, const std::string& data) {
+		uint32_t header[2] = { htonl((uint32_t)data.size()), htonl(type) };
+		return std::string(reinterpret_cast<const char*>(header), sizeof(header)) + data;
+	}
+
+	// joins with a connect packet, the dgram socket is bound to the address of the stream so the server knows where it comes from
+	bool connectClient(Client& client, const sockaddr_in& server, const std::string& username) {
+		client.stream = socket(AF_INET, SOCK_STREAM, 0);
+		client.dgram = socket(AF_INET, SOCK_DGRAM, 0);
+		if (connect(client.stream, reinterpret_cast<const sockaddr*>(&server), sizeof(server)) == -1)
+			return false;
+		sockaddr_in local;
+		socklen_t addrlen = sizeof(local);
+		getsockname(client.stream, reinterpret_cast<sockaddr*>(&local), &addrlen);
+		if (bind(client.dgram, reinterpret_cast<sockaddr*>(&local), sizeof(local)) == -1)
+			return false;
+		timeval timeout = { 1, 0 };
+		setsockopt(client.dgram, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		std::string connectPacket = packet(2, username); // eCONNECT
+		return send(client.stream, connectPacket.data(), connectPacket.size(), 0) == (ssize_t)connectPacket.size();
+	}
+
+	void closeClient(Client& client) {
+		char buf[2048];
+		while (recv(client.stream, buf, sizeof(buf), MSG_DONTWAIT) > 0) {} // unread data would reset the stream
+		close(client.stream);
+		close(client.dgram);
+	}
+
+	pid_t startServer(const std::string& path, const std::string& port, bool lowLatency, int& input) {
+		int pipeFds[2];
+		if (pipe(pipeFds) == -1)
+			return -1;
+		fflush(stdout); // the child would print the buffered output again
+		pid_t pid = fork();
+		if (pid == 0) {
+			dup2(pipeFds[0], STDIN_FILENO);
+			close(pipeFds[0]);
+			close(pipeFds[1]);
+			if (freopen("/dev/null", "w", stdout) == nullptr)
+				_exit(1);
+			std::vector<const char*> args = { path.c_str(), "--port", port.c_str() };
+			if (lowLatency)
+				args.push_back("--low-latency");
+			args.push_back(nullptr);
+			execv(path.c_str(), const_cast<char* const*>(args.data()));
+			perror("execv");
+			_exit(1);
+		}
+		close(pipeFds[0]);
+		input = pipeFds[1];
+		return pid;
+	}
+
+	void stopServer(pid_t pid, int input) {
+		if (write(input, "stop\n", 5) != 5)
+			kill(pid, SIGTERM);
+		close(input);
+		waitpid(pid, nullptr, 0);
+	}
+
+	// returns the relay latencies in us, empty if the server couldn't be reached
+	std::vector<double> measure(const std::string& path, const std::string& port, bool lowLatency, int moveCount, std::chrono::microseconds pause) {
+		std::vector<double> latencies;
+		int input;
+		pid_t pid = startServer(path, port, lowLatency, input);
+		if (pid == -1)
+			return latencies;
+		std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+		sockaddr_in server = {};
+		server.sin_family = AF_INET;
+		server.sin_port = htons((uint16_t)std::stoi(port));
+		server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		Client alice, bob;
+		if (connectClient(alice, server, "alice") && connectClient(bob, server, "bob")) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(200));
+			std::string username = "alice";
+			uint32_t usernameSize = htonl((uint32_t)username.size());
+			std::string move = packet(4, std::string(reinterpret_cast<const char*>(&usernameSize), sizeof(usernameSize)) + username + std::string(64, '\0')); // eMOVE
+			char buf[2048];
+			for (int i = 0; i < moveCount; i++) {
+				auto start = std::chrono::steady_clock::now();
+				sendto(alice.dgram, move.data(), move.size(), 0, reinterpret_cast<const sockaddr*>(&server), sizeof(server));
+				if (recv(bob.dgram, buf, sizeof(buf), 0) <= 0) {
+					fprintf(stderr, "move %d wasn't relayed\n", i);
+					break;
+				}
+				latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+				std::this_thread::sleep_for(pause);
+			}
+		}
+		closeClient(alice);
+		closeClient(bob);
+		stopServer(pid, input);
+		return latencies;
+	}
+
+	void printPercentiles(const char* profile, std::chrono::microseconds pause, std::vector<double> latencies) {
+		if (latencies.empty()) {
+			printf("%-12s pause %5lldus: no moves relayed\n", profile, (long long)pause.count());
+			return;
+		}
+		std::sort(latencies.begin(), latencies.end());
+		size_t n = latencies.size();
+		printf("%-12s pause %5lldus: p50 %.1fus p99 %.1fus max %.1fus (%zu moves)\n", profile, (long long)pause.count(),
+			latencies[n / 2], latencies[n * 99 / 100], latencies[n - 1], n);
+	}
+}
+
+int main(int argc, char** argv) {
+	std::string port = argc > 1 ? argv[1] : "12600";
+	int moveCount = argc > 2 ? std::stoi(argv[2]) : 3000;
+
+	char self[4096];
+	ssize_t selfSize = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	if (selfSize <= 0) {
+		perror("readlink");
+		return 1;
+	}
+	std::string path(self, selfSize);
+	path = path.substr(0, path.rfind('/') + 1) + "VOD_Server"; // the server is built next to the benchmarks
+
+	int errors = 0;
+	for (auto pause : { std::chrono::microseconds(100), std::chrono::microseconds(1000) }) {
+		for (bool lowLatency : { false, true }) {
+			std::vector<double> latencies = measure(path, port, lowLatency, moveCount, pause);
+			if ((int)latencies.size() != moveCount)
+				errors++;
+			printPercentiles(lowLatency ? "low latency" : "default", pause, latencies);
+		}
+	}
+	return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,48 @@
+// build with cmake -DVOD_BENCHMARKS=ON -DCMAKE_BUILD_TYPE=Release, runs as bin/VOD_SimulationBench
+// measures the cost of a simulation step per 1k players
+// with and without new inputs, a quarter of the players send an input every step
+
+#include "Objects/Simulation.h"
+
+#include <chrono>
+#include <random>
+#include <stdio.h>
+
+int main() {
+	const int totalPlayerSteps = 20000000; // the same work for every player count
+	for (int playerCount : { 1000, 10000, 50000 }) {
+		Simulation simulation;
+		std::mt19937 random(1);
+		for (int i = 1; i <= playerCount; i++)
+			simulation.add((uint16_t)i);
+		int steps = totalPlayerSteps / playerCount;
+
+		uint32_t sequence = 1;
+		auto start = std::chrono::steady_clock::now();
+		for (int step = 0; step < steps; step++) {
+			for (int i = 1; i <= playerCount; i += 4) {
+				Simulation::Input input;
+				input.sequence = sequence;
+				input.forward = (int8_t)(random() % 255 - 127);
+				input.strafe = (int8_t)(random() % 255 - 127);
+				input.turn = (int8_t)(random() % 255 - 127);
+				input.buttons = random() & (Simulation::eJUMP | Simulation::eSPRINT);
+				simulation.applyInput((uint16_t)i, input);
+			}
+			sequence++;
+			simulation.step(1.0f / 60);
+		}
+		double withInputs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+		start = std::chrono::steady_clock::now();
+		for (int step = 0; step < steps; step++)
+			simulation.step(1.0f / 60);
+		double stepOnly = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+		double perThousand = 1000.0 / playerCount / steps;
+		printf("%6d players: %.1f us per step per 1k players, %.1f us with inputs, %.3f%% of a core per 1k players at 60 Hz (x %.2f)\n",
+			playerCount, stepOnly * perThousand, withInputs * perThousand, withInputs * perThousand * 60 / 1e6 * 100,
+			simulation.players()[0].position[0]); // keeps the steps from being optimized away
+	}
+	return 0;
+}
@@ -1,9 +1,15 @@
 #include "Network.h"
 
 #include "Shares/NetworkData.h"
+#include "Objects/TimingWheel.h"
+#include "Objects/Task.h"
+#include "Objects/Connections.h"
+#include "Objects/Simulation.h"
+#include "Objects/LocalRing.h"
 
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <memory>
 #include <iostream>
 #include <string>
@@ -11,6 +17,9 @@
 #include <stdio.h>
 #include <vector>
 #include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 
 #ifdef _WIN32 // windows specific socket include
 
@@ -26,6 +35,14 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#include <linux/filter.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 typedef in_addr IN_ADDR;
 typedef in6_addr IN6_ADDR;
@@ -33,6 +50,32 @@ typedef in6_addr IN6_ADDR;
 #endif 
 
 #define UDP_PACKET_BUFFER_SIZE 1472
+#define MAX_STREAM_PACKET_SIZE 16384 // data size of the largest packet a client may send over its stream, a larger one closes it
+#define STREAM_RECV_SIZE 4096 // bytes read from a client stream per poll
+
+// pollfds owned by the server, they come before the client pollfds
+// (#0:tcp server)
+// (#1:udp server)
+// (#2:wakeup)
+// (#3:handoff listener, fd is -1 and ignored by poll if hot restart is disabled)
+// (#4:local listener, fd is -1 if the shared memory transport is disabled)
+// (#5:local doorbell, same)
+// followed by the dgram shards after the first one, see server::_serverPollfdCount
+#define SERVER_POLLFD_COUNT 6
+
+// the type field of a packet header holds the packet type in the low 16 bits
+// clients put their dgram steering session (see SessionPacket) into the high 16 bits
+#define PACKET_TYPE_MASK 0xffff
+#define PACKET_SESSION_SHIFT 16
+
+#define HANDOFF_MAGIC 0x564f4448 // "VODH", first field of the handoff header
+#define HANDOFF_MESSAGE_SIZE (4096 + MAX_STREAM_PACKET_SIZE) // a client message also carries the part of a packet the client sent so far
+#define HANDOFF_TIMEOUT_MS 5000 // the old server gives up on a new server that stalls during the handoff and keeps serving
+#define HANDOFF_STOPPED 2 // the last message of a handoff, the old server sends it once it stopped serving
+#define SCM_MAX_FDS 253 // most fds one SCM_RIGHTS message can carry on linux
+
+#define LOCAL_MAGIC 0x564f444c // "VODL", first field of the local handshake
+#define LOCAL_POPS_PER_WAKEUP 64 // packets taken from the up ring of one local client per doorbell
 
 namespace sock {
 	int closeSocket(int socket) {
@@ -82,6 +125,9 @@ namespace sock {
 		if (sa->sa_family == AF_INET) {
 			return addrToPresentationIPv4(reinterpret_cast<sockaddr_in*>(sa)->sin_addr);
 		}
+		if (sa->sa_family == AF_UNIX) { // a client of the shared memory transport
+			return "local";
+		}
 
 		return addrToPresentationIPv6(reinterpret_cast<sockaddr_in6*>(sa)->sin6_addr);
 	}
@@ -93,8 +139,10 @@ namespace sock {
 		if (a->sa_family == AF_INET) {
 			sockaddr_in sa4a = *reinterpret_cast<const sockaddr_in*>(a);
 			sockaddr_in sa4b = *reinterpret_cast<const sockaddr_in*>(b);
-			return *(uint32_t*)(&sa4a.sin_addr) - *(uint32_t*)(&sa4b.sin_addr) +
-				sa4a.sin_port - sa4b.sin_port;
+			// compared field by field, a sum of the differences can cancel out for different addresses
+			if (memcmp(&sa4a.sin_addr, &sa4b.sin_addr, sizeof(sa4a.sin_addr)) != 0)
+				return memcmp(&sa4a.sin_addr, &sa4b.sin_addr, sizeof(sa4a.sin_addr));
+			return (int)ntohs(sa4a.sin_port) - (int)ntohs(sa4b.sin_port);
 	}
 		else if (a->sa_family == AF_INET6) {
 			sockaddr_in6 sa6a = *reinterpret_cast<const sockaddr_in6*>(a);
@@ -107,6 +155,89 @@ namespace sock {
 		}
 }
 
+	// creates a pollable file descriptor that another thread can signal to wake up poll
+	// on linux this is an eventfd, on windows a loopback dgram socket connected to itself
+	int createWakeup() {
+#ifdef _WIN32
+		SOCKET fd = socket(AF_INET, SOCK_DGRAM, 0);
+		if (fd == INVALID_SOCKET)
+			return -1;
+		sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = 0;
+		int addrlen = sizeof(addr);
+		u_long nonBlocking = 1;
+		if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR ||
+			getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &addrlen) == SOCKET_ERROR ||
+			connect(fd, reinterpret_cast<sockaddr*>(&addr), addrlen) == SOCKET_ERROR ||
+			ioctlsocket(fd, FIONBIO, &nonBlocking) == SOCKET_ERROR) {
+			closesocket(fd);
+			return -1;
+		}
+		return (int)fd;
+#elif __linux__
+		return eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+	}
+
+	// makes the wakeup fd readable, can be called from any thread
+	void signalWakeup(int fd) {
+#ifdef _WIN32
+		char c = 0;
+		send(fd, &c, 1, 0);
+#elif __linux__
+		uint64_t one = 1;
+		if (write(fd, &one, sizeof(one)) < 0)
+			perror("signalWakeup");
+#endif
+	}
+
+	// consumes all pending signals of the wakeup fd
+	void clearWakeup(int fd) {
+#ifdef _WIN32
+		char buf[64];
+		while (recv(fd, buf, sizeof(buf), 0) > 0) {}
+#elif __linux__
+		uint64_t count;
+		while (read(fd, &count, sizeof(count)) > 0) {}
+#endif
+	}
+
+	// receives up to len bytes that already arrived on a blocking stream socket, never waits for more
+	// returns like recv, -1 with wouldBlock() if nothing arrived
+	int recvAvailable(int socket, char* buf, int len) {
+#ifdef _WIN32
+		u_long available = 0;
+		if (ioctlsocket(socket, FIONREAD, &available) == SOCKET_ERROR)
+			return -1;
+		if (available > 0 && available < (u_long)len) // nothing available after a poll means the stream closed, that recv returns right away
+			len = (int)available;
+		return recv(socket, buf, len, 0);
+#elif __linux__
+		return recv(socket, buf, len, MSG_DONTWAIT);
+#endif
+	}
+
+	bool wouldBlock() {
+#ifdef _WIN32
+		return WSAGetLastError() == WSAEWOULDBLOCK;
+#elif __linux__
+		return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+	}
+
+	// enables busy polling on the socket, the kernel spins for up to the given time waiting for packets instead of sleeping
+	// only supported on linux, does nothing elsewhere
+	void setBusyPoll(int socket, int microseconds) {
+#if defined(__linux__) && defined(SO_BUSY_POLL)
+		if (microseconds <= 0)
+			return;
+		if (setsockopt(socket, SOL_SOCKET, SO_BUSY_POLL, &microseconds, sizeof(microseconds)) == -1)
+			perror("setsockopt(SO_BUSY_POLL)");
+#endif
+	}
+
 	int lastError() {
 #ifdef _WIN32
 		return WSAGetLastError();
@@ -145,11 +276,71 @@ void ntohMat4(const void* nData, float mat4[16]) {
 	}
 }
 
+// floats are sent as their bits in network order
+uint32_t htonFloat(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(uint32_t));
+	return htonl(bits);
+}
+
+float ntohFloat(uint32_t nValue) {
+	uint32_t bits = ntohl(nValue);
+	float value;
+	memcpy(&value, &bits, sizeof(float));
+	return value;
+}
+
+// returns the translation part of a transform
+void mat4Position(const float mat4[16], float position[3]) {
+	position[0] = mat4[12];
+	position[1] = mat4[13];
+	position[2] = mat4[14];
+}
+
+float positionDistance(const float a[3], const float b[3]) {
+	float dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+	return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+struct ObservedEntity { // send scheduler state of one player as seen by one client
+	float priority = 0.0f; // grows every tick the update isn't sent, reset when it's sent
+	float lastSentPosition[3] = {};
+	bool pending = false; // there is an update this client hasn't received yet
+};
+
+struct LocalTransport { // shared memory of a local client, the up ring (client to server) followed by the down ring
+	int memory = -1; // memfd, kept to hand the client off on a hot restart
+	void* mapped = nullptr;
+	size_t mappedSize = 0;
+	uint32_t ringSize = 0; // capacity of each ring, the new server of a hot restart maps the memfd with it
+	LocalRing up;
+	LocalRing down;
+	uint64_t dropped = 0; // packets that didn't fit into the down ring
+
+	~LocalTransport() {
+#ifdef __linux__
+		if (mapped)
+			munmap(mapped, mappedSize);
+		if (memory != -1)
+			close(memory);
+#endif
+	}
+};
+
 struct SocketData { // combine the socket and its address into one type, cause they're always needed when using both tcp and udp.
 	std::string username;
 	int stream;
 	int dgram;
 	sockaddr_storage addr; // the udp address
+	std::unordered_map<std::string, ObservedEntity> observed = {}; // keyed by username, only used by the send scheduler
+	std::shared_ptr<LocalTransport> local = nullptr; // set for clients of the shared memory transport, stream is their unix socket then
+
+	// timers
+	uint32_t id = 0; // stable id for timer callbacks, the index in server::_clients changes on disconnects
+	uint16_t session = 0; // identifies the client in dgram steering and input commands, 0 if the client has none
+	uint64_t lastActivity = 0; // ms, time of the last packet from this client
+	TimingWheel::TimerId idleTimer = 0;
+	TimingWheel::TimerId heartbeatTimer = 0;
 
 	sockaddr* getAddr() {
 		return reinterpret_cast<sockaddr*>(&addr);
@@ -165,11 +356,19 @@ struct SocketData { // combine the socket and its address into one type, cause t
 
 /* Packets */
 
+// an immutable, already packed packet
+// it's packed once and the same buffer is shared by every recipient of a broadcast
+typedef std::shared_ptr<const std::vector<char>> PacketBuffer;
+
 enum PacketType {
 	eMESSAGE = 1,
 	eCONNECT = 2,
 	eDISCONNECT = 3,
-	eMOVE = 4
+	eMOVE = 4,
+	ePING = 5,
+	eSESSION = 6, // only sent by the server, it doesn't decode them
+	eINPUT = 7,
+	eSTATE = 8 // only sent by the server, it doesn't decode them
 };
 
 class Packet {
@@ -182,20 +381,43 @@ public:
 	// socket has to be a dgram socket
 	void sendToDgram(int socket, const sockaddr* addr, int flags = 0);
 
-	// receive a packet from the specified socket
+	// packs this packet into a new immutable buffer
+	// use this when the same packet is sent to multiple recipients, so it only gets packed once
+	PacketBuffer serialize();
+
+	// send an already packed packet to the specified socket
 	// socket has to be a stream socket or a connected dgram socket
-	static std::shared_ptr<Packet> receiveFrom(int& type, int socket, int flags = 0);
+	static void sendBufferTo(const PacketBuffer& buffer, int socket, int flags = 0);
+
+	// send an already packed packet to the specified socket
+	// socket has to be a dgram socket
+	static void sendBufferToDgram(const PacketBuffer& buffer, int socket, const sockaddr* addr, int flags = 0);
+
+	// unpacks the first packet of the bytes received on a stream, a packet can arrive in several pieces
+	// returns the bytes the packet took, 0 if it didn't arrive completely yet and -1 if its size is above MAX_STREAM_PACKET_SIZE
+	// spPacket is nullptr for an unknown type
+	static int unpackStream(int& type, std::shared_ptr<Packet>& spPacket, const char* buf, uint32_t size);
 
 	// receive a packet from the specified socket
 	// socket has to be a dgram socket
 	// the address that sent the received packet will be written to addr with the size of adrrlen
 	static std::shared_ptr<Packet> receiveFromDgram(int& type, int socket, sockaddr* addr, socklen_t* addrlen, int flags = 0);
 
+	// unpacks a whole packet that was received in one piece, like a datagram
+	// returns nullptr if it's too short or of an unknown type
+	static std::shared_ptr<Packet> unpack(int& type, const char* buf, uint32_t size);
+
 protected:
 	uint32_t fullSize();
 
 	static uint32_t headerSize();
 
+	// sends len bytes of buf, loops until everything is sent
+	static void sendRaw(const char* buf, uint32_t len, int socket, int flags);
+
+	// sends len bytes of buf as a single datagram
+	static void sendRawDgram(const char* buf, uint32_t len, int socket, const sockaddr* addr, int flags);
+
 	virtual uint32_t dataSize() = 0;
 
 	// packs just the header
@@ -280,29 +502,132 @@ protected:
 	void unpackData(const char* buf, uint32_t size);
 };
 
+class PingPacket : public Packet {
+	friend class Packet;
+public:
+	// no data, only keeps the connection alive
+
+protected:
+	uint32_t dataSize();
+
+	// packs the data into the given buffer, buffer needs to have the same size as packet.fullSize()
+	void pack(char* buf);
+
+	// takes just the data part
+	void unpackData(const char* buf, uint32_t size);
+};
+
+class SessionPacket : public Packet {
+	friend class Packet;
+public:
+	// data
+	uint32_t session = 0; // the client puts this into the high bits of the type field of its dgram packets and into its input packets
+	std::string username = ""; // every client gets the sessions of all players, to match the players of state packets
+
+protected:
+	uint32_t dataSize();
+
+	// packs the data into the given buffer, buffer needs to have the same size as packet.fullSize()
+	void pack(char* buf);
+
+	// takes just the data part
+	void unpackData(const char* buf, uint32_t size);
+};
+
+class InputPacket : public Packet {
+	friend class Packet;
+public:
+	// data
+	uint16_t session = 0;
+	Simulation::Input input = {};
+
+protected:
+	uint32_t dataSize();
+
+	// packs the data into the given buffer, buffer needs to have the same size as packet.fullSize()
+	void pack(char* buf);
+
+	// takes just the data part
+	void unpackData(const char* buf, uint32_t size);
+};
+
+class StatePacket : public Packet {
+	friend class Packet;
+public:
+	struct PlayerState {
+		uint16_t session = 0;
+		uint32_t sequence = 0; // the last input the server applied, clients reconcile their prediction with it
+		float position[3] = {};
+		float yaw = 0.0f;
+	};
+	static constexpr uint32_t PLAYER_STATE_SIZE = sizeof(uint16_t) + 5 * sizeof(uint32_t);
+	static constexpr uint32_t MAX_PLAYERS = (UDP_PACKET_BUFFER_SIZE - 4 * sizeof(uint32_t)) / PLAYER_STATE_SIZE; // more players are split into multiple packets
+
+	// data
+	uint32_t step = 0;
+	std::vector<PlayerState> players = {};
+
+protected:
+	uint32_t dataSize();
+
+	// packs the data into the given buffer, buffer needs to have the same size as packet.fullSize()
+	void pack(char* buf);
+
+	// takes just the data part
+	void unpackData(const char* buf, uint32_t size);
+};
+
 // Packet
 void Packet::sendTo(int socket, int flags) {
 	uint32_t len = fullSize();
 	char* buf = new char[len];
 	pack(buf);
+	sendRaw(buf, len, socket, flags);
+	delete[] buf;
+}
+
+void Packet::sendToDgram(int socket, const sockaddr* addr, int flags) {
+	char buf[UDP_PACKET_BUFFER_SIZE];
+	uint32_t len = fullSize();
+	if (len > UDP_PACKET_BUFFER_SIZE) {
+		printf("Packet::sendToDgram packet too large for a datagram\n");
+		return;
+	}
+	pack(buf);
+	sendRawDgram(buf, len, socket, addr, flags);
+}
+
+PacketBuffer Packet::serialize() {
+	auto spBuffer = std::make_shared<std::vector<char>>(fullSize());
+	pack(spBuffer->data());
+	return spBuffer;
+}
+
+void Packet::sendBufferTo(const PacketBuffer& buffer, int socket, int flags) {
+	sendRaw(buffer->data(), buffer->size(), socket, flags);
+}
 
+void Packet::sendBufferToDgram(const PacketBuffer& buffer, int socket, const sockaddr* addr, int flags) {
+	if (buffer->size() > UDP_PACKET_BUFFER_SIZE) {
+		printf("Packet::sendBufferToDgram packet too large for a datagram\n");
+		return;
+	}
+	sendRawDgram(buffer->data(), buffer->size(), socket, addr, flags);
+}
+
+void Packet::sendRaw(const char* buf, uint32_t len, int socket, int flags) {
 	uint32_t offset = 0;
 	while (offset < len) {
-		int bytesSent = send(socket, buf + offset, len - offset, 0);
+		int bytesSent = send(socket, buf + offset, len - offset, flags);
 		if (bytesSent == -1) {
 			sock::printLastError("Packet::send");
-			delete[] buf;
 			return;
 		}
 		offset += bytesSent;
 	}
-	delete[] buf;
 }
 
-void Packet::sendToDgram(int socket, const sockaddr* addr, int flags) {
-	char buf[UDP_PACKET_BUFFER_SIZE];
-	pack(buf);
-
+void Packet::sendRawDgram(const char* buf, uint32_t len, int socket, const sockaddr* addr, int flags) {
 	int addrlen;
 	if (addr->sa_family == AF_INET)
 		addrlen = sizeof(sockaddr_in);
@@ -312,67 +637,25 @@ void Packet::sendToDgram(int socket, const sockaddr* addr, int flags) {
 		printf("Packet::sendToDgram address family not supported\n");
 		exit(0);
 	}
-	int bytesSent = sendto(socket, buf, UDP_PACKET_BUFFER_SIZE, 0, addr, addrlen); // send header only
+	int bytesSent = sendto(socket, buf, len, flags, addr, addrlen); // the receiver reads the size from the header, no need to pad to UDP_PACKET_BUFFER_SIZE
 	if (bytesSent == -1) {
-		sock::printLastError("Packet::sendto header");
+		sock::printLastError("Packet::sendto");
 		return;
 	}
 }
 
-std::shared_ptr<Packet> Packet::receiveFrom(int& type, int socket, int flags) {
-	char* buf = new char[headerSize()];
-	int bytesRead = recv(socket, buf, headerSize(), 0); // get just header
-	if (bytesRead == -1) {
-		sock::printLastError("Packet::recv header");
-		delete[] buf;
-		return nullptr;
-	}
-	if (bytesRead == 0) { // detected a disconnect
-		printf("received disconnect\n");
-		delete[] buf;
-		return nullptr;
-	}
+int Packet::unpackStream(int& type, std::shared_ptr<Packet>& spPacket, const char* buf, uint32_t size) {
+	type = 0;
+	if (size < headerSize())
+		return 0;
 	uint32_t dataSize;
 	unpackHeader(buf, dataSize, type);
-	delete[] buf;
-
-	buf = new char[dataSize];
-	bytesRead = recv(socket, buf, dataSize, 0); // get just data
-	if (bytesRead == -1) {
-		sock::printLastError("Packet::recv data");
-		delete[] buf;
-		return nullptr;
-	}
-
-	std::shared_ptr<Packet> spPacket;
-	switch (type)
-	{
-	case eMESSAGE: {
-		spPacket = std::make_shared<MessagePacket>();
-		spPacket->unpackData(buf, dataSize);
-		break;
-	}
-	case eCONNECT: {
-		spPacket = std::make_shared<ConnectPacket>();
-		spPacket->unpackData(buf, dataSize);
-		break;
-	}
-	case eDISCONNECT: {
-		spPacket = std::make_shared<DisconnectPacket>();
-		spPacket->unpackData(buf, dataSize);
-		break;
-	}
-	case eMOVE: {
-		spPacket = std::make_shared<MovePacket>();
-		spPacket->unpackData(buf, dataSize);
-		break;
-	}
-	default:
-		break;
-	}
-	delete[] buf;
-
-	return spPacket;
+	if (dataSize > MAX_STREAM_PACKET_SIZE)
+		return -1;
+	if (size - headerSize() < dataSize)
+		return 0;
+	spPacket = unpack(type, buf, headerSize() + dataSize);
+	return headerSize() + dataSize;
 }
 
 std::shared_ptr<Packet> Packet::receiveFromDgram(int& type, int socket, sockaddr* addr, socklen_t* addrlen, int flags) {
@@ -382,10 +665,18 @@ std::shared_ptr<Packet> Packet::receiveFromDgram(int& type, int socket, sockaddr
 		sock::printLastError("Packet::recvfrom");
 		return nullptr;
 	}
-	char* ptr = buf;
+	return unpack(type, buf, bytesRead);
+}
+
+std::shared_ptr<Packet> Packet::unpack(int& type, const char* buf, uint32_t size) {
+	type = 0;
+	if (size < headerSize())
+		return nullptr;
+	const char* ptr = buf;
 	uint32_t dataSize;
 	unpackHeader(ptr, dataSize, type);
 	ptr += headerSize();
+	dataSize = std::min(dataSize, size - headerSize()); // don't trust the header with the size
 
 	std::shared_ptr<Packet> spPacket;
 	switch (type)
@@ -410,6 +701,16 @@ std::shared_ptr<Packet> Packet::receiveFromDgram(int& type, int socket, sockaddr
 		spPacket->unpackData(ptr, dataSize);
 		break;
 	}
+	case ePING: {
+		spPacket = std::make_shared<PingPacket>();
+		spPacket->unpackData(ptr, dataSize);
+		break;
+	}
+	case eINPUT: {
+		spPacket = std::make_shared<InputPacket>();
+		spPacket->unpackData(ptr, dataSize);
+		break;
+	}
 	default:
 		break;
 	}
@@ -435,7 +736,7 @@ void Packet::packHeader(char* buf, const int type) {
 void Packet::unpackHeader(const char* buf, uint32_t& size, int& type) {
 		const uint32_t* uintBuf = reinterpret_cast<const uint32_t*>(buf);
 		size = ntohl(uintBuf[0]);
-		type = ntohl(uintBuf[1]);
+		type = ntohl(uintBuf[1]) & PACKET_TYPE_MASK; // the session is only used by the kernel to steer the datagram
 	}
 
 // MessagePacket
@@ -455,9 +756,19 @@ void MessagePacket::pack(char* buf) {
 }
 
 void MessagePacket::unpackData(const char* buf, uint32_t size) {
-		uint32_t idSize = ntohl(reinterpret_cast<const uint32_t*>(buf)[0]); buf += sizeof(uint32_t);
+		if (size < 2 * sizeof(uint32_t)) // the sizes come from the client, a packet they don't fit is left empty
+			return;
+		uint32_t idSize = ntohl(reinterpret_cast<const uint32_t*>(buf)[0]);
+		if (idSize > size - 2 * sizeof(uint32_t))
+			return;
+		uint32_t msgSize;
+		memcpy(&msgSize, buf + sizeof(uint32_t) + idSize, sizeof(uint32_t));
+		msgSize = ntohl(msgSize);
+		if (msgSize > size - 2 * sizeof(uint32_t) - idSize)
+			return;
+		buf += sizeof(uint32_t);
 		id = std::string(buf, idSize); buf += idSize;
-		uint32_t msgSize = ntohl(reinterpret_cast<const uint32_t*>(buf)[0]); buf += sizeof(uint32_t);
+		buf += sizeof(uint32_t);
 		msg = std::string(buf, msgSize); buf += msgSize;
 }
 
@@ -506,51 +817,374 @@ void MovePacket::pack(char* buf) {
 }
 
 void MovePacket::unpackData(const char* buf, uint32_t size) {
-	uint32_t usernameSize = ntohl(reinterpret_cast<const uint32_t*>(buf)[0]); buf += sizeof(uint32_t);
+	if (size < sizeof(uint32_t) + sizeof(float) * 16) // left empty, no client has an empty username
+		return;
+	uint32_t usernameSize = ntohl(reinterpret_cast<const uint32_t*>(buf)[0]);
+	if (usernameSize != size - sizeof(uint32_t) - sizeof(float) * 16)
+		return;
+	buf += sizeof(uint32_t);
 	username = std::string(buf, usernameSize); buf += usernameSize;
 	ntohMat4(buf, transform);
 }
 
+// PingPacket
+uint32_t PingPacket::dataSize() {
+	return 0;
+}
+
+void PingPacket::pack(char* buf) {
+	packHeader(buf, ePING);
+}
+
+void PingPacket::unpackData(const char* buf, uint32_t size) {}
+
+// SessionPacket
+uint32_t SessionPacket::dataSize() {
+	return sizeof(uint32_t) + username.size();
+}
+
+void SessionPacket::pack(char* buf) {
+	packHeader(buf, eSESSION); buf += headerSize();
+	/* data */
+	uint32_t nSession = htonl(session);
+	memcpy(buf, &nSession, sizeof(uint32_t)); buf += sizeof(uint32_t);
+	memcpy(buf, username.data(), username.size());
+}
+
+void SessionPacket::unpackData(const char* buf, uint32_t size) {
+	if (size < sizeof(uint32_t))
+		return;
+	session = ntohl(reinterpret_cast<const uint32_t*>(buf)[0]); buf += sizeof(uint32_t);
+	username = std::string(buf, size - sizeof(uint32_t));
+}
+
+// InputPacket
+uint32_t InputPacket::dataSize() {
+	return sizeof(uint32_t) + sizeof(uint16_t) + 4 * sizeof(uint8_t);
+}
+
+void InputPacket::pack(char* buf) {
+	packHeader(buf, eINPUT); buf += headerSize();
+	/* data */
+	uint32_t nSequence = htonl(input.sequence);
+	uint16_t nSession = htons(session);
+	memcpy(buf, &nSequence, sizeof(uint32_t)); buf += sizeof(uint32_t);
+	memcpy(buf, &nSession, sizeof(uint16_t));  buf += sizeof(uint16_t);
+	buf[0] = input.forward;
+	buf[1] = input.strafe;
+	buf[2] = input.turn;
+	buf[3] = input.buttons;
+}
+
+void InputPacket::unpackData(const char* buf, uint32_t size) {
+	if (size < dataSize()) // sequence 0 is never applied
+		return;
+	uint32_t nSequence;
+	uint16_t nSession;
+	memcpy(&nSequence, buf, sizeof(uint32_t)); buf += sizeof(uint32_t);
+	memcpy(&nSession, buf, sizeof(uint16_t));  buf += sizeof(uint16_t);
+	input.sequence = ntohl(nSequence);
+	session = ntohs(nSession);
+	input.forward = buf[0];
+	input.strafe = buf[1];
+	input.turn = buf[2];
+	input.buttons = buf[3];
+}
+
+// StatePacket
+uint32_t StatePacket::dataSize() {
+	return 2 * sizeof(uint32_t) + players.size() * PLAYER_STATE_SIZE;
+}
+
+void StatePacket::pack(char* buf) {
+	packHeader(buf, eSTATE); buf += headerSize();
+	/* data */
+	uint32_t nStep = htonl(step);
+	uint32_t nCount = htonl(players.size());
+	memcpy(buf, &nStep, sizeof(uint32_t));  buf += sizeof(uint32_t);
+	memcpy(buf, &nCount, sizeof(uint32_t)); buf += sizeof(uint32_t);
+	for (const auto& player : players) {
+		uint16_t nSession = htons(player.session);
+		uint32_t nValues[5] = { htonl(player.sequence), htonFloat(player.position[0]), htonFloat(player.position[1]), htonFloat(player.position[2]), htonFloat(player.yaw) };
+		memcpy(buf, &nSession, sizeof(uint16_t)); buf += sizeof(uint16_t);
+		memcpy(buf, nValues, sizeof(nValues));    buf += sizeof(nValues);
+	}
+}
+
+void StatePacket::unpackData(const char* buf, uint32_t size) {
+	if (size < 2 * sizeof(uint32_t))
+		return;
+	uint32_t nStep, nCount;
+	memcpy(&nStep, buf, sizeof(uint32_t));  buf += sizeof(uint32_t);
+	memcpy(&nCount, buf, sizeof(uint32_t)); buf += sizeof(uint32_t);
+	step = ntohl(nStep);
+	uint32_t count = std::min(ntohl(nCount), (size - 2 * (uint32_t)sizeof(uint32_t)) / PLAYER_STATE_SIZE);
+	players.resize(count);
+	for (auto& player : players) {
+		uint16_t nSession;
+		uint32_t nValues[5];
+		memcpy(&nSession, buf, sizeof(uint16_t)); buf += sizeof(uint16_t);
+		memcpy(nValues, buf, sizeof(nValues));    buf += sizeof(nValues);
+		player.session = ntohs(nSession);
+		player.sequence = ntohl(nValues[0]);
+		for (int i = 0; i < 3; i++)
+			player.position[i] = ntohFloat(nValues[1 + i]);
+		player.yaw = ntohFloat(nValues[4]);
+	}
+}
+
 namespace server {
 	bool _isRunning = false;
 	std::mutex _mTerminate; // controls access to variables for terminating the server
-	volatile bool _shouldStop = false;
+	std::atomic<bool> _shouldStop = false; // checked by the loop after the wakeup fd was signaled
+	int _wakeup = -1; // signaled to wake the loop up from poll, see sock::createWakeup
+	int _handoffSocket = -1; // unix socket a new server connects to, to take over this one
+	bool _handedOff = false; // set when a new server took over, the process exits after the loop
+	int _handoffConnection = -1; // connection to the new server, it gets HANDOFF_STOPPED once the loop ended
 	std::thread _thread;
 
+	NetworkData _network; // the config the server was started with
+
 	SocketData _serverSocket;
 	// this stores all current users
 	// it's used for sending a new player all current players and for identifying clients
 	std::vector<SocketData> _clients = {};
 	int _eraseOffset = 0; // used in disconnect soeckt because 
 
+	uint32_t _nextClientId = 1;
+	std::unordered_map<uint32_t, size_t> _clientIndices = {}; // client id -> index in _clients, for timer callbacks
+	std::unordered_map<std::string, uint32_t> _clientIds = {}; // username -> client id, for dgram packets which only carry the username
+
+	// all timers of the server, advanced every loop iteration, ticks are ms
+	TimingWheel _timers;
+	TimingWheel::TimerId _tickTimer = 0;
+
+	/* Connection handlers */
+	// every client stream is handled by a coroutine (handleConnection), which awaits its packets one by one
+	// all of them run on the server thread, they are resumed by recvClient and by timers
+
+	using Frame = Connections<Packet>::Frame;
+	using Connection = Connections<Packet>::Connection;
+	Connections<Packet> _connections = { _timers }; // client id -> connection
+
+	Connections<Packet>::RecvFrame recvFrame(Connection& connection) {
+		return _connections.recvFrame(connection);
+	}
+
+	// co_await sendFrame(stream, buffer) sends an already packed packet, the send happens when it's awaited
+	// streams are blocking, so this completes right away and never suspends
+	struct SendFrame {
+		int stream;
+		const PacketBuffer* buffer; // a temporary lives until the end of the co_await expression
+
+		bool await_ready() { return true; }
+		void await_suspend(std::coroutine_handle<>) {}
+		void await_resume() {
+			Packet::sendBufferTo(*buffer, stream);
+		}
+	};
+
+	SendFrame sendFrame(int stream, const PacketBuffer& buffer) {
+		return { stream, &buffer };
+	}
+
+	Task handleConnection(uint32_t id);
+
+	struct EntityState { // latest state of a player, used by the send scheduler and the move filter
+		float position[3] = {};
+		PacketBuffer moveBuffer; // the latest move packet, packed once for all clients
+
+		// move filter, the last relayed move and the velocity clients extrapolate with
+		bool relayed = false;
+		float relayedTransform[16] = {};
+		float velocity[3] = {}; // units per second
+		std::chrono::steady_clock::time_point relayTime;
+		float latestTransform[16] = {}; // the latest move, differs from relayedTransform if it was dropped
+		TimingWheel::TimerId relayTimer = 0; // relays latestTransform after maxRelayInterval without a relay
+	};
+	std::unordered_map<std::string, EntityState> _entities = {}; // keyed by username
+
+	// sessions, given to clients if dgram steering or the input simulation is on
+	std::unordered_map<uint16_t, uint32_t> _sessionIds = {}; // session to client id
+
+	// input simulation
+	Simulation _simulation;
+	TimingWheel::TimerId _simulationTimer = 0;
+	uint64_t _simulationStart = 0; // ms, steps are scheduled relative to it so they don't drift
+
+	// dgram steering
+	struct ShardStats {
+		uint64_t received = 0; // moves and inputs received on this shard
+		uint64_t misSteered = 0; // the ones of clients owned by another shard
+	};
+	std::vector<int> _dgramShards = {}; // dgram sockets sharing the port, [0] is _serverSocket.dgram, a client is owned by shard session % count
+	std::vector<ShardStats> _shardStats = {};
+	uint16_t _nextSession = 1;
+
 	// the file descriptors used in the poll command
-	// (#0:tcp server)
-	// (#1:udp server)
-	// index can be converted to corresponding clientSocket index by -1
+	// the first _serverPollfdCount belong to the server, see SERVER_POLLFD_COUNT
+	// index can be converted to corresponding clientSocket index by -_serverPollfdCount
 	std::vector<pollfd> _pollfds = {};
+	size_t _serverPollfdCount = SERVER_POLLFD_COUNT;
+
+	// shared memory transport
+	int _localSocket = -1; // unix socket listener of local clients
+	int _localDoorbell = -1; // eventfd shared by all local clients, signaled when they push into an empty up ring
 
 	bool isRunning() {
 		std::lock_guard<std::mutex> lk(_mTerminate);
 		return _isRunning;
 	}
 
-	void acceptClient() {
-		sockaddr_storage clientAddr;
-		socklen_t addrSize = sizeof clientAddr;
-
-		SocketData socketData;
-		if ((socketData.stream = accept(_serverSocket.stream, reinterpret_cast<sockaddr*>(&clientAddr), &addrSize)) == -1) {
-			sock::printLastError("accept");
-			exit(sock::lastError());
+	// adds the pollfds of the server sockets, has to be done before any client pollfd is added
+	void addServerPollfds(const SocketData& socketData) {
+		pollfd serverStreamPollfd; // make a poll fd for the server socket, gets an event when a new client connects
+		serverStreamPollfd.fd = socketData.stream;
+		serverStreamPollfd.events = POLLIN;
+		serverStreamPollfd.revents = 0;
+		_pollfds.push_back(serverStreamPollfd);
+		pollfd serverDgramPollfd; // make a poll fd for the server socket, gets an event when a clientSocketDgram sends data
+		serverDgramPollfd.fd = socketData.dgram;
+		serverDgramPollfd.events = POLLIN;
+		serverDgramPollfd.revents = 0;
+		_pollfds.push_back(serverDgramPollfd);
+		pollfd wakeupPollfd; // make a poll fd for the wakeup, gets an event when another thread needs the loop, eg. to stop it
+		wakeupPollfd.fd = _wakeup;
+		wakeupPollfd.events = POLLIN;
+		wakeupPollfd.revents = 0;
+		_pollfds.push_back(wakeupPollfd);
+		pollfd handoffPollfd; // make a poll fd for the handoff listener, gets an event when a new server wants to take over
+		handoffPollfd.fd = _handoffSocket;
+		handoffPollfd.events = POLLIN;
+		handoffPollfd.revents = 0;
+		_pollfds.push_back(handoffPollfd);
+		pollfd localPollfd; // make a poll fd for the local listener, gets an event when a local client connects
+		localPollfd.fd = _localSocket;
+		localPollfd.events = POLLIN;
+		localPollfd.revents = 0;
+		_pollfds.push_back(localPollfd);
+		pollfd doorbellPollfd; // make a poll fd for the local doorbell, gets an event when local clients sent packets
+		doorbellPollfd.fd = _localDoorbell;
+		doorbellPollfd.events = POLLIN;
+		doorbellPollfd.revents = 0;
+		_pollfds.push_back(doorbellPollfd);
+		for (size_t shard = 1; shard < _dgramShards.size(); shard++) { // the first shard is the server dgram socket
+			pollfd shardPollfd;
+			shardPollfd.fd = _dgramShards[shard];
+			shardPollfd.events = POLLIN;
+			shardPollfd.revents = 0;
+			_pollfds.push_back(shardPollfd);
 		}
-		socketData.addr = clientAddr;
-		_clients.push_back(socketData);
-#
+		_serverPollfdCount = _pollfds.size();
+	}
+
+	void addClientPollfd(const SocketData& socketData) {
 		pollfd clientPollfd; // only for stream clients
 		clientPollfd.fd = socketData.stream;
 		clientPollfd.events = POLLIN;
 		clientPollfd.revents = 0;
-		_pollfds.push_back(clientPollfd); // add pollfd, client will be inserted into the map when receiving the connect packet
+		_pollfds.push_back(clientPollfd);
+	}
+
+	// returns the current index of the client in _clients, -1 if it disconnected
+	int findClient(uint32_t id) {
+		auto it = _clientIndices.find(id);
+		return it != _clientIndices.end() ? (int)it->second : -1;
+	}
+
+	// the client sent something, so it isn't idle
+	void touchClient(int index) {
+		if (index >= 0)
+			_clients[index].lastActivity = _timers.now();
+	}
+
+	void disconnectClient(int index);
+
+	// disconnects the client if it didn't send anything within the idle timeout
+	// the timer isn't rescheduled on every packet, instead it checks lastActivity when it fires and reschedules if the client was active
+	void checkIdle(uint32_t id) {
+		int index = findClient(id);
+		if (index < 0)
+			return;
+		SocketData& client = _clients[index];
+		client.idleTimer = 0;
+
+		uint64_t deadline = client.lastActivity + _network.idleTimeout;
+		if (deadline > _timers.now()) {
+			client.idleTimer = _timers.schedule(deadline, [id]() { checkIdle(id); });
+			return;
+		}
+
+		printf("%s timed out\n", client.username.empty() ? sock::addrToPresentation(client.getAddr()).c_str() : client.username.c_str());
+		if (!client.username.empty()) { // other clients won't get a disconnect packet from a silent client, so send it for it
+			DisconnectPacket packet;
+			packet.username = client.username;
+			PacketBuffer buffer = packet.serialize();
+			for (const auto& other : _clients) {
+				if (other.stream != client.stream)
+					Packet::sendBufferTo(buffer, other.stream);
+			}
+		}
+		disconnectClient(index);
+	}
+
+	void sendHeartbeat(uint32_t id) {
+		static PacketBuffer pingBuffer = PingPacket().serialize(); // every ping is the same
+		int index = findClient(id);
+		if (index < 0)
+			return;
+		SocketData& client = _clients[index];
+		Packet::sendBufferTo(pingBuffer, client.stream);
+		client.heartbeatTimer = _timers.schedule(_timers.now() + _network.heartbeatInterval, [id]() { sendHeartbeat(id); });
+	}
+
+	// clients get sessions if dgram steering or the input simulation needs them
+	bool usesSessions() {
+		return _dgramShards.size() > 1 || _network.simulateInputs;
+	}
+
+	// maps the session to the client and gives it a player if the input simulation is on
+	void addSession(uint16_t session, uint32_t id) {
+		_sessionIds[session] = id;
+		if (_network.simulateInputs)
+			_simulation.add(session);
+	}
+
+	// adds a new client to _clients and the pollfds and starts its timers
+	void registerClient(SocketData socketData) {
+		socketData.id = _nextClientId++;
+		socketData.lastActivity = _timers.now();
+		uint32_t id = socketData.id;
+		if (_network.idleTimeout > 0)
+			socketData.idleTimer = _timers.schedule(_timers.now() + _network.idleTimeout, [id]() { checkIdle(id); });
+		if (_network.heartbeatInterval > 0)
+			socketData.heartbeatTimer = _timers.schedule(_timers.now() + _network.heartbeatInterval, [id]() { sendHeartbeat(id); });
+
+		_clientIndices[id] = _clients.size();
+		if (!socketData.username.empty())
+			_clientIds[socketData.username] = id;
+		if (socketData.session != 0) // taken over from another server, the simulation restarts with the player at the origin
+			addSession(socketData.session, id);
+		_clients.push_back(socketData);
+		addClientPollfd(socketData);
+
+		_connections.open(id);
+		handleConnection(id); // runs until it awaits the first frame
+	}
+
+	void acceptClient() {
+		sockaddr_storage clientAddr;
+		socklen_t addrSize = sizeof clientAddr;
+
+		SocketData socketData;
+		if ((socketData.stream = accept(_serverSocket.stream, reinterpret_cast<sockaddr*>(&clientAddr), &addrSize)) == -1) {
+			sock::printLastError("accept");
+			exit(sock::lastError());
+		}
+		socketData.addr = clientAddr;
+		if (_network.lowLatency)
+			sock::setBusyPoll(socketData.stream, _network.busyPollMicroseconds);
+		registerClient(socketData); // client will be inserted into the map when receiving the connect packet
 
 		printf("client connected: %s\n", sock::addrToPresentation(reinterpret_cast<sockaddr*>(&clientAddr)).c_str());
 	}
@@ -558,8 +1192,29 @@ namespace server {
 	void disconnectClient(int index) {
 		if(index < 0)
 			return;
-		SocketData socket = _clients[index];
+		SocketData& socket = _clients[index];
 		printf("client disconnected: %s\n", sock::addrToPresentation(reinterpret_cast<sockaddr*>(&socket.addr)).c_str());
+		if (socket.local && socket.local->dropped > 0)
+			printf("%llu packets didn't fit into the down ring of %s\n", (unsigned long long)socket.local->dropped, socket.username.c_str());
+
+		if (!socket.username.empty()) { // forget the player in the send scheduler and the move filter
+			auto itEntity = _entities.find(socket.username);
+			if (itEntity != _entities.end()) {
+				_timers.cancel(itEntity->second.relayTimer);
+				_entities.erase(itEntity);
+			}
+			for (auto& client : _clients)
+				client.observed.erase(socket.username);
+			_clientIds.erase(socket.username);
+		}
+		if (socket.session != 0) {
+			_sessionIds.erase(socket.session);
+			_simulation.remove(socket.session);
+		}
+		_timers.cancel(socket.idleTimer);
+		_timers.cancel(socket.heartbeatTimer);
+		_clientIndices.erase(socket.id);
+		_connections.close(socket.id);
 
 		if (sock::closeSocket(socket.stream) < 0) {
 			sock::printLastError("close(st#ream)");
@@ -568,10 +1223,220 @@ namespace server {
 
 
 		_clients.erase(_clients.begin() + index); // delete the clients socket data
-		_pollfds.erase(_pollfds.begin() + index + 2); // delete the clients pollfd, +2 for the server pollfds
+		_pollfds.erase(_pollfds.begin() + index + _serverPollfdCount); // delete the clients pollfd, skip the server pollfds
+		for (size_t i = index; i < _clients.size(); i++) // the erase shifted these clients
+			_clientIndices[_clients[i].id] = i;
 		_eraseOffset++;
 	}
 
+	// packs the packet once and sends the same buffer to every client over its stream socket
+	// the client with the stream exceptStream is skipped
+	void broadcast(Packet& packet, int exceptStream = -1) {
+		PacketBuffer buffer = packet.serialize();
+		for (const auto& client : _clients) {
+			if (client.stream != exceptStream)
+				Packet::sendBufferTo(buffer, client.stream);
+		}
+	}
+
+	// sends an already packed packet to the dgram address of the client
+	// local clients get it copied into their down ring, it's dropped like a datagram if the ring is full
+	void sendDgramTo(const PacketBuffer& buffer, const SocketData& client) {
+		if (client.local) {
+			bool wasEmpty;
+			if (!client.local->down.push(buffer->data(), (uint32_t)buffer->size(), wasEmpty))
+				client.local->dropped++;
+			return;
+		}
+		Packet::sendBufferToDgram(buffer, _serverSocket.dgram, reinterpret_cast<const sockaddr*>(&client.addr));
+	}
+
+	// packs the packet once and sends the same buffer to every client over the server dgram socket
+	// the client with the username exceptUsername is skipped
+	void broadcastDgram(Packet& packet, const std::string& exceptUsername) {
+		PacketBuffer buffer = packet.serialize();
+		for (const auto& client : _clients) {
+			if (client.username != exceptUsername)
+				sendDgramTo(buffer, client);
+		}
+	}
+
+	void relayLatest(const std::string& username);
+
+	// makes transform the new base of the prediction, like the clients do when they receive it
+	void setRelayed(const std::string& username, EntityState& entity, const float transform[16]) {
+		auto now = std::chrono::steady_clock::now();
+		if (entity.relayed) {
+			float elapsed = std::chrono::duration<float>(now - entity.relayTime).count();
+			float position[3], relayedPosition[3];
+			mat4Position(transform, position);
+			mat4Position(entity.relayedTransform, relayedPosition);
+			for (int i = 0; i < 3; i++) // velocity between the last two relayed moves, same as the clients see it
+				entity.velocity[i] = elapsed > 0.0f ? (position[i] - relayedPosition[i]) / elapsed : 0.0f;
+		}
+		entity.relayed = true;
+		memcpy(entity.relayedTransform, transform, sizeof(entity.relayedTransform));
+		memcpy(entity.latestTransform, transform, sizeof(entity.latestTransform));
+		entity.relayTime = now;
+
+		_timers.cancel(entity.relayTimer);
+		entity.relayTimer = _timers.schedule(_timers.now() + std::max(1, _network.maxRelayInterval), [username]() { relayLatest(username); });
+	}
+
+	// returns true if the move can be dropped, because it's within the error of what clients predict from the last relayed move
+	// otherwise the move becomes the new base of the prediction
+	bool filterMove(MovePacket& packet) {
+		EntityState& entity = _entities[packet.username];
+		float position[3];
+		mat4Position(packet.transform, position);
+
+		if (entity.relayed) {
+			float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - entity.relayTime).count();
+			bool expired = elapsed * 1000.0f >= _network.maxRelayInterval;
+
+			float relayedPosition[3];
+			mat4Position(entity.relayedTransform, relayedPosition);
+			float predicted[3];
+			for (int i = 0; i < 3; i++)
+				predicted[i] = relayedPosition[i] + entity.velocity[i] * elapsed;
+
+			float rotationDelta = 0.0f;
+			for (int column = 0; column < 3; column++)
+				for (int row = 0; row < 3; row++)
+					rotationDelta = std::max(rotationDelta, std::abs(packet.transform[column * 4 + row] - entity.relayedTransform[column * 4 + row]));
+
+			if (!expired && positionDistance(position, predicted) <= _network.positionError && rotationDelta <= _network.rotationError) {
+				memcpy(entity.latestTransform, packet.transform, sizeof(entity.latestTransform));
+				return true;
+			}
+		}
+
+		setRelayed(packet.username, entity, packet.transform);
+		return false;
+	}
+
+	// a player that stops sending would be extrapolated forever, so its latest move is relayed every maxRelayInterval
+	// until the clients hold it still, which takes two relays of the same position
+	void relayLatest(const std::string& username) {
+		auto it = _entities.find(username);
+		if (it == _entities.end())
+			return;
+		EntityState& entity = it->second;
+		entity.relayTimer = 0;
+		bool still = entity.velocity[0] == 0.0f && entity.velocity[1] == 0.0f && entity.velocity[2] == 0.0f;
+		if (still && memcmp(entity.latestTransform, entity.relayedTransform, sizeof(entity.latestTransform)) == 0)
+			return;
+
+		MovePacket packet;
+		packet.username = username;
+		memcpy(packet.transform, entity.latestTransform, sizeof(packet.transform));
+		setRelayed(username, entity, packet.transform);
+		broadcastDgram(packet, username);
+	}
+
+	// stores the move as the latest state of its player, the scheduler sends it on the next ticks
+	void queueMove(MovePacket& packet) {
+		EntityState& entity = _entities[packet.username];
+		mat4Position(packet.transform, entity.position);
+		entity.moveBuffer = packet.serialize();
+		for (auto& client : _clients) {
+			if (!client.username.empty() && client.username != packet.username)
+				client.observed[packet.username].pending = true;
+		}
+	}
+
+	// sends every client its pending moves, highest priority first, until the clients byte budget is used up
+	// the priority accumulates every tick an update waits, so low priority updates are only delayed and never starved
+	void scheduleTick() {
+		struct Candidate {
+			float priority;
+			ObservedEntity* observed;
+			const EntityState* entity;
+		};
+		static std::vector<Candidate> candidates; // reused to avoid allocating every tick
+
+		for (auto& client : _clients) {
+			if (client.username.empty())
+				continue;
+			auto itSelf = _entities.find(client.username);
+			const float* observerPosition = itSelf != _entities.end() ? itSelf->second.position : nullptr;
+
+			candidates.clear();
+			for (auto& [username, observed] : client.observed) {
+				if (!observed.pending)
+					continue;
+				auto itEntity = _entities.find(username);
+				if (itEntity == _entities.end())
+					continue;
+				const EntityState& entity = itEntity->second;
+
+				float change = positionDistance(entity.position, observed.lastSentPosition);
+				float distance = observerPosition ? positionDistance(entity.position, observerPosition) : 0.0f;
+				observed.priority += (1.0f + _network.changeWeight * change) / (1.0f + _network.distanceWeight * distance);
+				candidates.push_back({ observed.priority, &observed, &entity });
+			}
+			std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.priority > b.priority; });
+
+			int budget = _network.bytesPerTick;
+			for (const auto& candidate : candidates) {
+				int size = (int)candidate.entity->moveBuffer->size();
+				if (size > budget)
+					break;
+				sendDgramTo(candidate.entity->moveBuffer, client);
+				budget -= size;
+
+				ObservedEntity& observed = *candidate.observed;
+				observed.pending = false;
+				observed.priority = 0.0f;
+				memcpy(observed.lastSentPosition, candidate.entity->position, sizeof(observed.lastSentPosition));
+			}
+		}
+	}
+
+	// runs the send scheduler and schedules the next tick
+	void tick() {
+		scheduleTick();
+		_tickTimer = _timers.schedule(_timers.now() + 1000 / std::max(1, _network.tickRate), tick);
+	}
+
+	// sends the state of all players to every joined client, split into as many packets as needed
+	void broadcastState() {
+		const auto& players = _simulation.players();
+		StatePacket packet;
+		packet.step = _simulation.stepCount();
+		for (size_t first = 0; first < players.size(); first += StatePacket::MAX_PLAYERS) {
+			size_t count = std::min<size_t>(StatePacket::MAX_PLAYERS, players.size() - first);
+			packet.players.resize(count);
+			for (size_t i = 0; i < count; i++) {
+				const Simulation::Player& player = players[first + i];
+				StatePacket::PlayerState& state = packet.players[i];
+				state.session = player.session;
+				state.sequence = player.input.sequence;
+				memcpy(state.position, player.position, sizeof(state.position));
+				state.yaw = player.yaw;
+			}
+			broadcastDgram(packet, ""); // "" skips the clients that haven't joined yet
+		}
+	}
+
+	// advances the simulation by one fixed step, broadcasts the state every few steps and schedules the next step
+	void simulationStep() {
+		int rate = std::max(1, _network.simulationRate);
+		_simulation.step(1.0f / rate);
+		uint32_t stepsPerSnapshot = std::max(1, rate / std::max(1, _network.snapshotRate));
+		if (_simulation.stepCount() % stepsPerSnapshot == 0)
+			broadcastState();
+		uint64_t nextStep = _simulationStart + (uint64_t)(_simulation.stepCount() + 1) * 1000 / rate;
+		_simulationTimer = _timers.schedule(nextStep, simulationStep);
+	}
+
+	// returns true if the packet came from owner, over its stream or local rings or from its dgram address
+	bool sentBy(SocketData& owner, const SocketData& socket) {
+		if (&owner == &socket)
+			return true;
+		return !owner.local && !socket.local && owner.compAddr(socket) == 0;
+	}
+
 	void handlePacket(SocketData& socket, std::shared_ptr<Packet> spPacket, int type, int clientIndex) {
 		if(!spPacket.get()){
 			disconnectClient(clientIndex);
@@ -579,95 +1444,728 @@ namespace server {
 		}
 		switch (type)
 		{
-			//case eMESSAGE: {
-			//	MessagePacket& packet = *reinterpret_cast<MessagePacket*>(spPacket.get());
-			//	printf("server msg: %s (%s)\n", packet.msg.c_str(), packet.id.c_str());
-			//	for (int clientSocket : clientStorage.sockets)
-			//		packet.sendTo(clientSocket);
-			//	break;
-			//}
-		case eCONNECT: { // uses stream sockets
-			ConnectPacket& packet = *reinterpret_cast<ConnectPacket*>(spPacket.get());
-			{
-				bool nameTaken = false;
-				for (const auto& client : _clients)
-					if (client.username == packet.username) {
-						nameTaken = true;
-						break;
-					}
-				if (nameTaken) {
-					printf("%s already present, wont be accepted\n", packet.username.c_str());
-					disconnectClient(clientIndex);
-					break;
-				}
-			} // prevent multiple usernames
+		case eMESSAGE: { // uses stream sockets
+			MessagePacket& packet = *reinterpret_cast<MessagePacket*>(spPacket.get());
+			if (socket.username.empty() || packet.msg.empty()) // only joined clients can chat, malformed messages are empty
+				break;
+			packet.id = socket.username; // the sender can't speak for someone else
+			printf("server msg: %s (%s)\n", packet.msg.c_str(), packet.id.c_str());
+			broadcast(packet); // tell all clients(including the sender) about the message
+			break;
+		}
+		case eMOVE: { // uses dgram sockets
+			MovePacket& packet = *reinterpret_cast<MovePacket*>(spPacket.get());
+			auto itId = _clientIds.find(packet.username);
+			if (itId == _clientIds.end()) // moves of players that aren't connected would stay in the scheduler and filter state forever
+				break;
+			int index = findClient(itId->second);
+			if (index < 0 || !sentBy(_clients[index], socket)) // only the client of the player can move it
+				break;
+			touchClient(index);
+			if (_network.simulateInputs) // the simulation decides where players are
+				break;
+			if (_network.filterMoves && filterMove(packet))
+				break;
+			if (_network.scheduleUpdates) {
+				queueMove(packet);
+				break;
+			}
+			broadcastDgram(packet, packet.username);
+			break;
+		}
+		case eINPUT: { // uses dgram sockets
+			InputPacket& packet = *reinterpret_cast<InputPacket*>(spPacket.get());
+			if (!_network.simulateInputs)
+				break;
+			auto itId = _sessionIds.find(packet.session);
+			if (itId == _sessionIds.end())
+				break;
+			int index = findClient(itId->second);
+			if (index < 0 || !sentBy(_clients[index], socket)) // only the client of the session can control its player
+				break;
+			touchClient(index);
+			_simulation.applyInput(packet.session, packet.input);
+			break;
+		}
+		case ePING: { // only keeps the connection alive, recvClient already marked the client as active
+			break;
+		}
+		default: {
+			break;
+		}
+		}
+	}
 
-			socket.username = packet.username;
-			printf("%s joined the server\n", packet.username.c_str());
+	// returns a session no connected client holds, 0 if all of them are taken
+	uint16_t allocateSession() {
+		for (uint32_t tries = 0; tries < UINT16_MAX; tries++) {
+			uint16_t session = _nextSession++;
+			if (_nextSession == 0)
+				_nextSession = 1;
+			if (!_sessionIds.count(session))
+				return session;
+		}
+		return 0;
+	}
 
-			for (auto clientSocket : _clients) {
-				packet.sendTo(clientSocket.stream); // tell all clients(including the new one) that a new player joined
-				if (clientSocket.stream != socket.stream) {
-					ConnectPacket connectPacket;
-					connectPacket.username = clientSocket.username;
-					connectPacket.sendTo(socket.stream); // send the new client all clients that where already present
+	// the handshake of a new client, returns false if the client can't join
+	bool joinClient(SocketData& socket, ConnectPacket& packet) {
+		if (packet.username.empty()) { // an empty username marks clients that haven't joined
+			printf("empty username, wont be accepted\n");
+			return false;
+		}
+		{
+			bool nameTaken = false;
+			for (const auto& client : _clients)
+				if (client.username == packet.username) {
+					nameTaken = true;
+					break;
 				}
+			if (nameTaken) {
+				printf("%s already present, wont be accepted\n", packet.username.c_str());
+				return false;
 			}
+		} // prevent multiple usernames
 
-			break;
+		uint16_t session = 0;
+		if (usesSessions() && (session = allocateSession()) == 0) {
+			printf("no free session for %s, wont be accepted\n", packet.username.c_str());
+			return false;
 		}
-		case eDISCONNECT: { // uses stream sockets
-			DisconnectPacket& packet = *reinterpret_cast<DisconnectPacket*>(spPacket.get());
-
-			{
-				bool nameTaken = false;
-				for (const auto& client : _clients)
-					if (client.username == packet.username) {
-						nameTaken = true;
-						break;
-					}
-				if (!nameTaken) {
-					printf("%s not present, already disconnected\n", packet.username.c_str());
+
+		socket.username = packet.username;
+		_clientIds[socket.username] = socket.id;
+		printf("%s joined the server\n", packet.username.c_str());
+
+		if (session != 0) {
+			socket.session = session;
+			addSession(socket.session, socket.id);
+		}
+
+		PacketBuffer connectBuffer = packet.serialize(); // same for every client, only pack once
+		for (const auto& clientSocket : _clients)
+			Packet::sendBufferTo(connectBuffer, clientSocket.stream); // tell all clients(including the new one) that a new player joined
+
+		if (socket.session != 0) { // same for sessions, the new client finds its own session by its username
+			SessionPacket sessionPacket;
+			sessionPacket.session = socket.session;
+			sessionPacket.username = socket.username;
+			PacketBuffer sessionBuffer = sessionPacket.serialize();
+			for (const auto& clientSocket : _clients)
+				Packet::sendBufferTo(sessionBuffer, clientSocket.stream);
+		}
+		return true;
+	}
+
+	// the client announced that it leaves, it's removed once its stream closes
+	void leaveClient(SocketData& socket, DisconnectPacket& packet) {
+		{
+			bool nameTaken = false;
+			for (const auto& client : _clients)
+				if (client.username == packet.username) {
+					nameTaken = true;
 					break;
 				}
-			} // prevent multiple disconnects
+			if (!nameTaken) {
+				printf("%s not present, already disconnected\n", packet.username.c_str());
+				return;
+			}
+		} // prevent multiple disconnects
+
+		printf("%s left the server\n", packet.username.c_str());
+		PacketBuffer buffer = packet.serialize();
+		for (const auto& client : _clients) {
+			if (client.stream != socket.stream)
+				Packet::sendBufferTo(buffer, client.stream);
+		}
+	}
 
-			printf("%s left the server\n", packet.username.c_str());
-			for (auto clientSocket : _clients) {
-				if (clientSocket.stream != socket.stream)
-					packet.sendTo(clientSocket.stream);
+	// the coroutine of a client stream
+	// a new client has to start with a connect packet, after that its packets go to handlePacket
+	// clients that were taken over from another server already joined and skip the handshake
+	Task handleConnection(uint32_t id) {
+		auto guard = _connections.guard(id);
+		Connection& connection = *_connections.find(id);
+
+		if (_clients[findClient(id)].username.empty()) {
+			Frame frame = co_await recvFrame(connection);
+			if (!frame.spPacket || frame.type != eCONNECT) {
+				if (!connection.closed)
+					disconnectClient(findClient(id));
+				co_return;
+			}
+			if (!joinClient(_clients[findClient(id)], *reinterpret_cast<ConnectPacket*>(frame.spPacket.get()))) {
+				disconnectClient(findClient(id));
+				co_return;
+			}
+
+			// send the new client all clients that where already present, then their sessions
+			int stream = _clients[findClient(id)].stream;
+			for (const auto& clientSocket : _clients) {
+				if (clientSocket.id == id)
+					continue;
+				ConnectPacket connectPacket;
+				connectPacket.username = clientSocket.username;
+				co_await sendFrame(stream, connectPacket.serialize());
+			}
+			for (const auto& clientSocket : _clients) {
+				if (clientSocket.id == id || clientSocket.session == 0)
+					continue;
+				SessionPacket sessionPacket;
+				sessionPacket.session = clientSocket.session;
+				sessionPacket.username = clientSocket.username;
+				co_await sendFrame(stream, sessionPacket.serialize());
 			}
-			break;
 		}
-		case eMOVE: { // uses dgram sockets
-			MovePacket& packet = *reinterpret_cast<MovePacket*>(spPacket.get());
-			for (auto clientSocket : _clients) {
-				if (packet.username != clientSocket.username)
-					packet.sendToDgram(_serverSocket.dgram, reinterpret_cast<const sockaddr*>(&clientSocket.addr));
+
+		while (true) {
+			Frame frame = co_await recvFrame(connection);
+			if (!frame.spPacket) {
+				if (!connection.closed)
+					disconnectClient(findClient(id));
+				co_return;
 			}
-			break;
+
+			int index = findClient(id);
+			if (frame.type == eDISCONNECT)
+				leaveClient(_clients[index], *reinterpret_cast<DisconnectPacket*>(frame.spPacket.get()));
+			else
+				handlePacket(_clients[index], frame.spPacket, frame.type, index);
 		}
-		default: {
-			break;
+	}
+
+	// counts moves and inputs that the kernel steered to another shard than the one owning the client
+	void countSteering(size_t shard, int type, Packet* packet) {
+		int index = -1;
+		if (type == eMOVE) {
+			auto itId = _clientIds.find(reinterpret_cast<MovePacket*>(packet)->username);
+			if (itId != _clientIds.end())
+				index = findClient(itId->second);
 		}
+		else if (type == eINPUT) {
+			auto itId = _sessionIds.find(reinterpret_cast<InputPacket*>(packet)->session);
+			if (itId != _sessionIds.end())
+				index = findClient(itId->second);
 		}
+		else
+			return;
+
+		ShardStats& stats = _shardStats[shard];
+		stats.received++;
+		if (index >= 0 && _clients[index].session % _dgramShards.size() != shard)
+			stats.misSteered++;
 	}
 
-	void recvClientDgram(int clientIndex) {
+	void recvClientDgram(int clientIndex, size_t shard = 0) {
 		sockaddr_storage addr;
 		socklen_t addrlen = sizeof(sockaddr_storage);
 
 		int type;
-		auto spPacket = Packet::receiveFromDgram(type, _serverSocket.dgram, reinterpret_cast<sockaddr*>(&addr), &addrlen);
+		auto spPacket = Packet::receiveFromDgram(type, _dgramShards[shard], reinterpret_cast<sockaddr*>(&addr), &addrlen);
+		if (spPacket && _dgramShards.size() > 1)
+			countSteering(shard, type, spPacket.get());
 		SocketData addrOnly;
 		addrOnly.addr = addr;
 		handlePacket(addrOnly, spPacket, type, clientIndex); // for dgram packets only their origin address is known while the sockets are unknown
 	}
 
+	// reads what arrived on the stream of a client without blocking and hands its complete packets to the coroutine
+	// the part of a packet that didn't arrive yet waits in the received buffer of the connection
 	void recvClient(SocketData& socket, int clientIndex) {
-		int type;
-		auto spPacket = Packet::receiveFrom(type, socket.stream);
-		handlePacket(socket, spPacket, type, clientIndex);
+		uint32_t id = socket.id;
+		Connection* connection = _connections.find(id);
+		if (!connection)
+			return;
+		touchClient(clientIndex);
+
+		char buf[STREAM_RECV_SIZE];
+		int bytesRead = sock::recvAvailable(socket.stream, buf, sizeof(buf));
+		if (bytesRead == -1 && sock::wouldBlock())
+			return;
+		if (bytesRead <= 0) {
+			if (bytesRead == -1)
+				sock::printLastError("Packet::recv");
+			else
+				printf("received disconnect\n");
+			_connections.deliverFrame(id, {}); // a nullptr packet tells the coroutine that the stream closed
+			return;
+		}
+		connection->received.insert(connection->received.end(), buf, buf + bytesRead);
+
+		while (connection) {
+			int type;
+			std::shared_ptr<Packet> spPacket;
+			int packetSize = Packet::unpackStream(type, spPacket, connection->received.data(), connection->received.size());
+			if (packetSize == 0)
+				return;
+			if (packetSize == -1) {
+				printf("client sent a packet larger than %u bytes\n", (unsigned)MAX_STREAM_PACKET_SIZE);
+				_connections.deliverFrame(id, {});
+				return;
+			}
+			connection->received.erase(connection->received.begin(), connection->received.begin() + packetSize);
+			_connections.deliverFrame(id, { type, spPacket }); // an unknown type closes the stream too
+			connection = _connections.find(id); // the coroutine may have disconnected the client
+		}
+	}
+
+#ifdef __linux__
+	// sends one message over a unix socket, the fds are attached with SCM_RIGHTS
+	// used by the hot restart and the handshake of local clients
+	bool sendFdMessage(int unixSocket, const char* buf, size_t size, const int* fds, int fdCount) {
+		iovec iov;
+		iov.iov_base = const_cast<char*>(buf);
+		iov.iov_len = size;
+
+		msghdr msg = {};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+
+		std::vector<char> control(CMSG_SPACE(sizeof(int) * fdCount));
+		if (fdCount > 0) {
+			msg.msg_control = control.data();
+			msg.msg_controllen = control.size();
+			cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fdCount);
+			memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fdCount);
+		}
+
+		if (sendmsg(unixSocket, &msg, 0) != (ssize_t)size) {
+			sock::printLastError("sendmsg");
+			return false;
+		}
+		return true;
+	}
+
+	// receives one message and the fds attached to it
+	// fdCount is the capacity of fds and gets the number of received fds
+	// returns the size of the message, 0 if the other side closed the socket, -1 on error
+	int recvFdMessage(int unixSocket, char* buf, size_t size, int* fds, int& fdCount) {
+		iovec iov;
+		iov.iov_base = buf;
+		iov.iov_len = size;
+
+		std::vector<char> control(CMSG_SPACE(sizeof(int) * fdCount));
+		msghdr msg = {};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.data();
+		msg.msg_controllen = control.size();
+
+		int bytesRead = recvmsg(unixSocket, &msg, MSG_CMSG_CLOEXEC);
+		if (bytesRead == -1) {
+			sock::printLastError("recvmsg");
+			return -1;
+		}
+		if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+			fprintf(stderr, "fd message truncated\n");
+			return -1;
+		}
+
+		int capacity = fdCount;
+		fdCount = 0;
+		for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+			int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			for (int i = 0; i < count && fdCount < capacity; i++)
+				memcpy(&fds[fdCount++], CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+		}
+		return bytesRead;
+	}
+
+	sockaddr_un handoffAddr(const std::string& path) {
+		sockaddr_un addr = {};
+		addr.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(addr.sun_path)) {
+			fprintf(stderr, "unix socket path too long: %s\n", path.c_str());
+			exit(1);
+		}
+		memcpy(addr.sun_path, path.c_str(), path.size());
+		return addr;
+	}
+
+	// ring sizes the local transport accepts, for the configured one and the ones of taken over clients
+	// a ring has to hold at least one record of the largest dgram packet
+	bool validLocalRingSize(uint32_t ringSize) {
+		return ringSize >= UDP_PACKET_BUFFER_SIZE + sizeof(uint32_t) && (ringSize & (ringSize - 1)) == 0;
+	}
+
+	// maps the shared memory of a local client, a new one is created if memory is -1
+	// returns nullptr on failure
+	std::shared_ptr<LocalTransport> mapLocalTransport(uint32_t ringSize, int memory = -1) {
+		auto transport = std::make_shared<LocalTransport>();
+		bool create = memory == -1;
+		transport->mappedSize = 2 * LocalRing::mappedSize(ringSize);
+		transport->ringSize = ringSize;
+		if (create) {
+			// sealed so the client can't shrink it, accessing the cut off pages would kill the server with SIGBUS
+			if ((memory = memfd_create("vod-local", MFD_CLOEXEC | MFD_ALLOW_SEALING)) == -1 || ftruncate(memory, transport->mappedSize) == -1 ||
+				fcntl(memory, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1) {
+				sock::printLastError("local memfd");
+				if (memory != -1)
+					close(memory);
+				return nullptr;
+			}
+		}
+		transport->memory = memory;
+		struct stat memoryStat;
+		if (fstat(memory, &memoryStat) == -1 || (size_t)memoryStat.st_size < transport->mappedSize) { // a taken over memfd has to fit the ring size
+			fprintf(stderr, "local memfd too small for rings of %u bytes\n", ringSize);
+			return nullptr;
+		}
+		void* mapped = mmap(nullptr, transport->mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, memory, 0);
+		if (mapped == MAP_FAILED) {
+			sock::printLastError("local mmap");
+			return nullptr;
+		}
+		transport->mapped = mapped;
+		transport->up = LocalRing(mapped, ringSize, create);
+		transport->down = LocalRing(reinterpret_cast<char*>(mapped) + LocalRing::mappedSize(ringSize), ringSize, create);
+		return transport;
+	}
+#endif
+
+	// opens the unix socket local clients connect to, unless it was taken over with the hot restart
+	// handshake: the local client connects, the server answers with (magic, ring size) and the memfd and doorbell fds
+	// the client maps the memfd, an up ring followed by a down ring (see LocalRing), then it continues like on a tcp stream
+	// it pushes dgram packets into the up ring and signals the doorbell if push says the ring was empty
+	// the down ring has no doorbell, local clients read it whenever they like, eg. once per frame
+	void openLocalListener() {
+		if (_network.localPath.empty())
+			return;
+#ifdef __linux__
+		uint32_t ringSize = _network.localRingSize;
+		if (!validLocalRingSize(ringSize)) {
+			fprintf(stderr, "local ring size has to be a power of two of at least %u\n", (unsigned)(UDP_PACKET_BUFFER_SIZE + sizeof(uint32_t)));
+			exit(1);
+		}
+		if (_localSocket == -1) {
+			sockaddr_un addr = handoffAddr(_network.localPath);
+			if ((_localSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+				sock::printLastError("local socket");
+				exit(sock::lastError());
+			}
+			unlink(_network.localPath.c_str()); // remove the socket file of a previous server
+			if (bind(_localSocket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+				sock::printLastError("local bind");
+				exit(sock::lastError());
+			}
+			if (listen(_localSocket, SOMAXCONN) < 0) {
+				sock::printLastError("local listen");
+				exit(sock::lastError());
+			}
+			if ((_localDoorbell = sock::createWakeup()) == -1) {
+				sock::printLastError("local doorbell");
+				exit(sock::lastError());
+			}
+		}
+		_pollfds[4].fd = _localSocket;
+		_pollfds[5].fd = _localDoorbell;
+#else
+		fprintf(stderr, "the shared memory transport is only supported on linux\n");
+#endif
+	}
+
+	void closeLocalListener() {
+		if (_localSocket == -1)
+			return;
+		sock::closeSocket(_localSocket);
+		sock::closeSocket(_localDoorbell);
+#ifdef __linux__
+		if (!_handedOff) // the new server listens on it now
+			unlink(_network.localPath.c_str());
+#endif
+		_localSocket = -1;
+		_localDoorbell = -1;
+	}
+
+	void acceptLocalClient() {
+#ifdef __linux__
+		SocketData socketData;
+		if ((socketData.stream = accept4(_localSocket, nullptr, nullptr, SOCK_CLOEXEC)) == -1) {
+			sock::printLastError("local accept");
+			return;
+		}
+		uint32_t ringSize = _network.localRingSize;
+		socketData.local = mapLocalTransport(ringSize);
+		uint32_t handshake[2] = { htonl(LOCAL_MAGIC), htonl(ringSize) };
+		int fds[2] = { socketData.local ? socketData.local->memory : -1, _localDoorbell };
+		if (!socketData.local || !sendFdMessage(socketData.stream, reinterpret_cast<char*>(handshake), sizeof(handshake), fds, 2)) {
+			fprintf(stderr, "local handshake failed\n");
+			sock::closeSocket(socketData.stream);
+			return;
+		}
+		socketData.dgram = -1;
+		memset(&socketData.addr, 0, sizeof(socketData.addr));
+		socketData.addr.ss_family = AF_UNIX;
+		registerClient(socketData); // continues like a tcp client, it joins with a connect packet on its stream
+
+		printf("client connected: local\n");
+#endif
+	}
+
+	// handles the packets in the up rings of all local clients, at most LOCAL_POPS_PER_WAKEUP per ring
+	// so one busy client can't hold up the sockets, the timers and the other rings
+	// the doorbell only rings for an empty ring, so it's signaled again while a ring has packets left
+	void recvLocalClients() {
+		sock::clearWakeup(_localDoorbell);
+		char buf[UDP_PACKET_BUFFER_SIZE]; // records are dgram packets, larger ones are skipped
+		bool packetsLeft = false;
+		for (size_t i = 0; i < _clients.size(); i++) {
+			if (!_clients[i].local)
+				continue;
+			LocalRing& up = _clients[i].local->up;
+			uint32_t size;
+			for (int pops = 0; pops < LOCAL_POPS_PER_WAKEUP && (size = up.pop(buf, sizeof(buf))) > 0; pops++) {
+				int type;
+				auto spPacket = Packet::unpack(type, buf, size);
+				if (spPacket) // dgram packets never disconnect a client, so i stays valid
+					handlePacket(_clients[i], spPacket, type, -1);
+			}
+			if (!up.empty())
+				packetsLeft = true;
+		}
+		if (packetsLeft) // handled after the other pollfds in the next loop iteration
+			sock::signalWakeup(_localDoorbell);
+	}
+
+	// opens the unix socket a new server connects to, to take over this one
+	void openHandoffListener() {
+		if (_network.handoffPath.empty())
+			return;
+#ifdef __linux__
+		sockaddr_un addr = handoffAddr(_network.handoffPath);
+		if ((_handoffSocket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0) {
+			sock::printLastError("handoff socket");
+			exit(sock::lastError());
+		}
+		unlink(_network.handoffPath.c_str()); // remove the socket file of a previous server
+		if (bind(_handoffSocket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+			sock::printLastError("handoff bind");
+			exit(sock::lastError());
+		}
+		if (chmod(_network.handoffPath.c_str(), S_IRUSR | S_IWUSR) < 0) { // whoever connects gets the fds of all clients, only the owner may, before listen so nobody connects earlier
+			sock::printLastError("handoff chmod");
+			exit(sock::lastError());
+		}
+		if (listen(_handoffSocket, 1) < 0) {
+			sock::printLastError("handoff listen");
+			exit(sock::lastError());
+		}
+		_pollfds[3].fd = _handoffSocket;
+#else
+		fprintf(stderr, "hot restart is only supported on linux\n");
+#endif
+	}
+
+	void closeHandoffListener() {
+		if (_handoffSocket == -1)
+			return;
+		if (sock::closeSocket(_handoffSocket) == -1)
+			sock::printLastError("Server close(handoffSocket)");
+#ifdef __linux__
+		unlink(_network.handoffPath.c_str());
+#endif
+		_handoffSocket = -1;
+		if (_pollfds.size() > 3)
+			_pollfds[3].fd = -1;
+	}
+
+	// hands the server sockets and all clients over to the new server connecting to the handoff listener
+	// messages: header(magic, client count, shard count, local fd count) with the server stream, dgram shard and local listener and doorbell fds
+	// then one message per client (username size, username, address, session, ring size, received size, received bytes) with its stream fd, local clients also send their memfd
+	// the new server answers with one byte once it has everything, after that this server stops and sends HANDOFF_STOPPED
+	// the new server only starts serving with HANDOFF_STOPPED, if the old server gave up on the handoff it just closes the connection
+	void handOff() {
+#ifdef __linux__
+		int unixSocket = accept4(_handoffSocket, nullptr, nullptr, SOCK_CLOEXEC);
+		if (unixSocket == -1) {
+			sock::printLastError("handoff accept");
+			return;
+		}
+		timeval timeout = { HANDOFF_TIMEOUT_MS / 1000, (HANDOFF_TIMEOUT_MS % 1000) * 1000 }; // the server loop is blocked until the handoff ends
+		if (setsockopt(unixSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1 ||
+			setsockopt(unixSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1) {
+			sock::printLastError("handoff setsockopt(SO_RCVTIMEO/SO_SNDTIMEO)");
+			sock::closeSocket(unixSocket);
+			return;
+		}
+		printf("handing off to a new server\n");
+
+		char buf[HANDOFF_MESSAGE_SIZE];
+		bool success = true;
+		{
+			uint32_t localFdCount = _localSocket != -1 ? 2 : 0;
+			uint32_t header[4] = { htonl(HANDOFF_MAGIC), htonl((uint32_t)_clients.size()), htonl((uint32_t)_dgramShards.size()), htonl(localFdCount) };
+			std::vector<int> fds = { _serverSocket.stream };
+			fds.insert(fds.end(), _dgramShards.begin(), _dgramShards.end());
+			if (localFdCount > 0) {
+				fds.push_back(_localSocket);
+				fds.push_back(_localDoorbell);
+			}
+			success = sendFdMessage(unixSocket, reinterpret_cast<char*>(header), sizeof(header), fds.data(), (int)fds.size());
+		}
+		for (size_t i = 0; success && i < _clients.size(); i++) {
+			const SocketData& client = _clients[i];
+			Connection* connection = _connections.find(client.id);
+			uint32_t receivedSize = connection ? (uint32_t)connection->received.size() : 0;
+			if (4 * sizeof(uint32_t) + client.username.size() + sizeof(sockaddr_storage) + receivedSize > HANDOFF_MESSAGE_SIZE) {
+				fprintf(stderr, "handoff: username of %s too long\n", client.username.c_str());
+				success = false;
+				break;
+			}
+			char* ptr = buf;
+			uint32_t usernameSize = htonl(client.username.size());
+			memcpy(ptr, &usernameSize, sizeof(uint32_t));           ptr += sizeof(uint32_t);
+			memcpy(ptr, client.username.data(), client.username.size()); ptr += client.username.size();
+			memcpy(ptr, &client.addr, sizeof(sockaddr_storage));    ptr += sizeof(sockaddr_storage);
+			uint32_t session = htonl(client.session);
+			memcpy(ptr, &session, sizeof(uint32_t));                ptr += sizeof(uint32_t);
+			uint32_t ringSize = htonl(client.local ? client.local->ringSize : 0); // the new server may be configured with another size
+			memcpy(ptr, &ringSize, sizeof(uint32_t));               ptr += sizeof(uint32_t);
+			uint32_t nReceivedSize = htonl(receivedSize); // the part of a packet the client sent so far, the new server reads the rest
+			memcpy(ptr, &nReceivedSize, sizeof(uint32_t));          ptr += sizeof(uint32_t);
+			if (receivedSize > 0)
+				memcpy(ptr, connection->received.data(), receivedSize);
+			ptr += receivedSize;
+			int fds[2] = { client.stream, client.local ? client.local->memory : -1 };
+			success = sendFdMessage(unixSocket, buf, ptr - buf, fds, client.local ? 2 : 1);
+		}
+
+		char ack = 0;
+		if (success && recv(unixSocket, &ack, 1, 0) == 1) { // the new server has everything, stop serving
+			closeHandoffListener(); // before sending HANDOFF_STOPPED, the new server binds the path once it got it
+			_handedOff = true;
+			_handoffConnection = unixSocket;
+			_shouldStop.store(true, std::memory_order_release);
+		}
+		else {
+			fprintf(stderr, "handoff failed, continuing to serve\n");
+			sock::closeSocket(unixSocket);
+		}
+#endif
+	}
+
+	// tells the new server that this one stopped serving, after that it takes over
+	void finishHandOff() {
+		if (_handoffConnection == -1)
+			return;
+#ifdef __linux__
+		char stopped = HANDOFF_STOPPED;
+		if (send(_handoffConnection, &stopped, 1, MSG_NOSIGNAL) != 1)
+			sock::printLastError("handoff send");
+#endif
+		sock::closeSocket(_handoffConnection);
+		_handoffConnection = -1;
+	}
+
+	// connects to the server listening on handoffPath and takes over its sockets and clients
+	SocketData takeOverServer(NetworkData& network) {
+		SocketData socketData;
+#ifdef __linux__
+		sockaddr_un addr = handoffAddr(network.handoffPath);
+		int unixSocket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+		if (unixSocket < 0) {
+			sock::printLastError("takeover socket");
+			exit(sock::lastError());
+		}
+		if (connect(unixSocket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+			sock::printLastError("takeover connect");
+			exit(sock::lastError());
+		}
+
+		char buf[HANDOFF_MESSAGE_SIZE];
+		int fds[SCM_MAX_FDS];
+		int fdCount = SCM_MAX_FDS;
+		int bytesRead = recvFdMessage(unixSocket, buf, sizeof(buf), fds, fdCount);
+		const uint32_t* header = reinterpret_cast<const uint32_t*>(buf);
+		if (bytesRead != 4 * sizeof(uint32_t) || ntohl(header[0]) != HANDOFF_MAGIC || ntohl(header[2]) < 1 ||
+			fdCount != 1 + (int)ntohl(header[2]) + (int)ntohl(header[3])) {
+			fprintf(stderr, "takeover: invalid handoff header\n");
+			exit(1);
+		}
+		uint32_t clientCount = ntohl(header[1]);
+		int shardCount = (int)ntohl(header[2]);
+		socketData.stream = fds[0];
+		socketData.dgram = fds[1];
+		_dgramShards.assign(fds + 1, fds + 1 + shardCount); // the steering program stays attached to the shards
+		if (ntohl(header[3]) == 2) { // local clients keep their doorbell
+			_localSocket = fds[1 + shardCount];
+			_localDoorbell = fds[2 + shardCount];
+		}
+		_shardStats.assign(_dgramShards.size(), {});
+		socklen_t addrlen = sizeof(socketData.addr);
+		getsockname(socketData.stream, reinterpret_cast<sockaddr*>(&socketData.addr), &addrlen);
+		addServerPollfds(socketData);
+
+		for (uint32_t i = 0; i < clientCount; i++) {
+			SocketData client;
+			int clientFds[2];
+			fdCount = 2;
+			bytesRead = recvFdMessage(unixSocket, buf, sizeof(buf), clientFds, fdCount);
+			client.stream = clientFds[0];
+			if (bytesRead < (int)sizeof(uint32_t) || fdCount < 1) {
+				fprintf(stderr, "takeover: invalid client message\n");
+				exit(1);
+			}
+			const char* ptr = buf;
+			uint32_t usernameSize = ntohl(reinterpret_cast<const uint32_t*>(ptr)[0]); ptr += sizeof(uint32_t);
+			if (bytesRead < (int)(4 * sizeof(uint32_t) + sizeof(sockaddr_storage)) ||
+				usernameSize > bytesRead - 4 * sizeof(uint32_t) - sizeof(sockaddr_storage)) {
+				fprintf(stderr, "takeover: invalid client message\n");
+				exit(1);
+			}
+			client.username = std::string(ptr, usernameSize);  ptr += usernameSize;
+			memcpy(&client.addr, ptr, sizeof(sockaddr_storage)); ptr += sizeof(sockaddr_storage);
+			client.session = (uint16_t)ntohl(reinterpret_cast<const uint32_t*>(ptr)[0]); ptr += sizeof(uint32_t);
+			uint32_t ringSize = ntohl(reinterpret_cast<const uint32_t*>(ptr)[0]); ptr += sizeof(uint32_t);
+			uint32_t receivedSize = ntohl(reinterpret_cast<const uint32_t*>(ptr)[0]); ptr += sizeof(uint32_t);
+			if (bytesRead != (int)(4 * sizeof(uint32_t) + usernameSize + sizeof(sockaddr_storage) + receivedSize)) {
+				fprintf(stderr, "takeover: invalid client message\n");
+				exit(1);
+			}
+			client.dgram = socketData.dgram;
+			if (fdCount == 2) { // a local client, its rings are still in the memfd
+				if (validLocalRingSize(ringSize))
+					client.local = mapLocalTransport(ringSize, clientFds[1]);
+				if (!client.local) {
+					fprintf(stderr, "takeover: can't map the rings of %s\n", client.username.c_str());
+					exit(1);
+				}
+			}
+			if (network.lowLatency)
+				sock::setBusyPoll(client.stream, network.busyPollMicroseconds);
+			registerClient(client);
+			_connections.find(_clients.back().id)->received.assign(ptr, ptr + receivedSize);
+		}
+
+		char ack = 1;
+		if (send(unixSocket, &ack, 1, 0) != 1) {
+			sock::printLastError("takeover send");
+			exit(sock::lastError());
+		}
+		char stopped = 0;
+		if (recv(unixSocket, &stopped, 1, 0) != 1 || stopped != HANDOFF_STOPPED) { // a close means the old server gave up on the handoff and still serves
+			fprintf(stderr, "takeover: the old server didn't stop, exiting\n");
+			exit(1);
+		}
+		sock::closeSocket(unixSocket);
+
+		if (network.lowLatency)
+			for (int shard : _dgramShards)
+				sock::setBusyPoll(shard, network.busyPollMicroseconds);
+		for (const auto& client : _clients) // keep handing out unique sessions
+			if (client.session >= _nextSession)
+				_nextSession = client.session == UINT16_MAX ? 1 : client.session + 1;
+		printf("took over %u clients\n", clientCount);
+#else
+		fprintf(stderr, "hot restart is only supported on linux\n");
+		exit(1);
+#endif
+		return socketData;
 	}
 
 	void handlePoll(int pollCount) {
@@ -686,17 +2184,47 @@ namespace server {
 			recvClientDgram(-1);
 			checkedPollCount++;
 		}
+		for (size_t shard = 1; shard < _dgramShards.size(); shard++) { // the other dgram shards
+			pollfd shardPollfd = _pollfds[SERVER_POLLFD_COUNT + shard - 1];
+			if (shardPollfd.revents & POLLIN) {
+				recvClientDgram(-1, shard);
+				checkedPollCount++;
+			}
+		}
+		pollfd wakeupPollfd = _pollfds[2];
+		if (wakeupPollfd.revents & POLLIN) { // only wakes the loop up, the reason is checked there
+			sock::clearWakeup(_wakeup);
+			checkedPollCount++;
+		}
+		pollfd handoffPollfd = _pollfds[3];
+		if (handoffPollfd.revents & POLLIN) { // a new server wants to take over
+			handOff();
+			if (_handedOff) // the sockets belong to the new server now, don't read from them anymore
+				return;
+			checkedPollCount++;
+		}
+		pollfd localPollfd = _pollfds[4];
+		if (localPollfd.revents & POLLIN) { // a local client connects
+			acceptLocalClient();
+			checkedPollCount++;
+		}
+		pollfd doorbellPollfd = _pollfds[5];
+		if (doorbellPollfd.revents & POLLIN) { // local clients sent dgram packets
+			recvLocalClients();
+			checkedPollCount++;
+		}
 
 		// go through all clients
 		// i is the index of the client in clientSockets
-		int eraseOffset = 0; // offset the index by the times erase was used as erase shifts all remaining indices by -1
-		for (size_t i = 0; i < _pollfds.size() - 2; i++) { // go through all client sockets
-			pollfd poll = _pollfds[i + 2]; // +2 for the 2 server sockets
-			if (poll.revents & POLLHUP) {
-				disconnectClient(i - eraseOffset);
-			}
+		_eraseOffset = 0; // offset the index by the times erase was used as erase shifts all remaining indices by -1
+		for (size_t i = 0; i < _pollfds.size() - _serverPollfdCount + _eraseOffset; i++) { // go through all client sockets
+			pollfd poll = _pollfds[i - _eraseOffset + _serverPollfdCount]; // skip the server pollfds
+			int erasedBefore = _eraseOffset;
 			if (poll.revents & POLLIN) {
-				recvClient(_clients[i - eraseOffset], i - eraseOffset);
+				recvClient(_clients[i - _eraseOffset], i - _eraseOffset);
+			}
+			if ((poll.revents & POLLHUP) && _eraseOffset == erasedBefore) { // the recv may have disconnected it already
+				disconnectClient(i - _eraseOffset);
 			}
 
 			if (poll.revents & (POLLIN | POLLHUP)) // add checked if poll had events
@@ -712,12 +2240,83 @@ namespace server {
 			sock::printLastError("Server close(serverSocket.stream)");
 		if (sock::closeSocket(_serverSocket.dgram) == -1)
 			sock::printLastError("Server close(serverSocket.dgram)");
+		for (size_t shard = 1; shard < _dgramShards.size(); shard++)
+			if (sock::closeSocket(_dgramShards[shard]) == -1)
+				sock::printLastError("Server close(dgramShard)");
+		if (_dgramShards.size() > 1)
+			for (size_t shard = 0; shard < _shardStats.size(); shard++)
+				printf("dgram shard %zu: %llu moves and inputs, %llu mis-steered\n", shard,
+					(unsigned long long)_shardStats[shard].received, (unsigned long long)_shardStats[shard].misSteered);
+		_dgramShards.clear();
+		_shardStats.clear();
+		if (sock::closeSocket(_wakeup) == -1)
+			sock::printLastError("Server close(wakeup)");
+		_wakeup = -1;
 		for (const auto& socket : _clients)
 			if (sock::closeSocket(socket.stream) == -1)
 				sock::printLastError("Server close(clientSocket)");
 
+		closeHandoffListener();
+		closeLocalListener();
+
 		_pollfds.clear();
 		_clients.clear();
+		_entities.clear();
+		_clientIndices.clear();
+		_clientIds.clear();
+		_connections.clear();
+		_timers = TimingWheel();
+		_tickTimer = 0;
+		_simulationTimer = 0;
+		_simulation = Simulation();
+		_sessionIds.clear();
+	}
+
+	// binds the dgram socket and shardCount - 1 more as one SO_REUSEPORT group
+	// and attaches a classic bpf program to the group that returns session % shardCount as the index of the receiving socket
+	void openDgramShards(int dgram, addrinfo* serverInfo, int shardCount) {
+#ifdef __linux__
+		int yes = 1;
+		for (int shard = 0; shard < shardCount; shard++) {
+			int fd = dgram;
+			if (shard > 0 && (fd = socket(serverInfo->ai_family, SOCK_DGRAM, 0)) < 0) {
+				sock::printLastError("socket");
+				exit(sock::lastError());
+			}
+			if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1) {
+				sock::printLastError("setsockopt(SO_REUSEPORT)");
+				exit(sock::lastError());
+			}
+			if (bind(fd, serverInfo->ai_addr, serverInfo->ai_addrlen) < 0) { // the bind order is the index in the group
+				sock::printLastError("bind");
+				exit(sock::lastError());
+			}
+			if (shard > 0)
+				_dgramShards.push_back(fd);
+		}
+
+		// the kernel runs this on the udp payload, a load past the end of a packet too short for the header makes the program return 0
+		// so those land on shard 0, like the packets of clients without a session (session 0)
+		sock_filter code[] = {
+			{ BPF_LD | BPF_W | BPF_ABS, 0, 0, sizeof(uint32_t) },         // A = type field of the header, converted to host order
+			{ BPF_ALU | BPF_RSH | BPF_K, 0, 0, PACKET_SESSION_SHIFT },    // A = session
+			{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)shardCount },    // A = shard of the session
+			{ BPF_RET | BPF_A, 0, 0, 0 },
+		};
+		sock_fprog program;
+		program.len = sizeof(code) / sizeof(code[0]);
+		program.filter = code;
+		if (setsockopt(dgram, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) == -1) {
+			sock::printLastError("setsockopt(SO_ATTACH_REUSEPORT_CBPF)");
+			exit(sock::lastError());
+		}
+#else
+		fprintf(stderr, "dgram steering is only supported on linux, using a single dgram socket\n");
+		if (bind(dgram, serverInfo->ai_addr, serverInfo->ai_addrlen) < 0) {
+			sock::printLastError("bind");
+			exit(sock::lastError());
+		}
+#endif
 	}
 
 	SocketData getServerSocket(NetworkData& network) {
@@ -760,7 +2359,10 @@ namespace server {
 			sock::printLastError("bind");
 			exit(sock::lastError());
 		}
-		if (bind(socketData.dgram, serverInfo->ai_addr, serverInfo->ai_addrlen) < 0) {
+		_dgramShards = { socketData.dgram };
+		if (network.dgramShards > 1)
+			openDgramShards(socketData.dgram, serverInfo, network.dgramShards);
+		else if (bind(socketData.dgram, serverInfo->ai_addr, serverInfo->ai_addrlen) < 0) {
 			sock::printLastError("bind");
 			exit(sock::lastError());
 		}
@@ -770,41 +2372,109 @@ namespace server {
 			exit(sock::lastError());
 		}
 
+		_shardStats.assign(_dgramShards.size(), {});
+		if (network.lowLatency)
+			for (int shard : _dgramShards)
+				sock::setBusyPoll(shard, network.busyPollMicroseconds);
+
 		socketData.addr = *reinterpret_cast<sockaddr_storage*>(serverInfo->ai_addr);
 
-		pollfd serverStreamPollfd; // make a poll fd for the server socket, gets an event when a new client connects
-		serverStreamPollfd.fd = socketData.stream;
-		serverStreamPollfd.events = POLLIN;
-		serverStreamPollfd.revents = 0;
-		_pollfds.push_back(serverStreamPollfd);
-		pollfd serverDgramPollfd; // make a poll fd for the server socket, gets an event when a clientSocketDgram sends data
-		serverDgramPollfd.fd = socketData.dgram;
-		serverDgramPollfd.events = POLLIN;
-		serverDgramPollfd.revents = 0;
-		_pollfds.push_back(serverDgramPollfd);
+		addServerPollfds(socketData);
 
 		freeaddrinfo(serverInfo);
 
 		return socketData;
 	}
 
-	void loop(NetworkData network) {
-		_serverSocket = getServerSocket(network);
-		printf("server running\n");
+	// pins the calling thread to the given cpus, invalid cpus are ignored
+	void pinThread(const std::vector<int>& cpus) {
+		if (cpus.empty())
+			return;
+#ifdef _WIN32
+		DWORD_PTR mask = 0;
+		for (int cpu : cpus)
+			if (cpu >= 0 && cpu < (int)(sizeof(DWORD_PTR) * 8))
+				mask |= (DWORD_PTR)1 << cpu;
+		if (mask == 0 || SetThreadAffinityMask(GetCurrentThread(), mask) == 0)
+			fprintf(stderr, "pinThread: failed to set thread affinity\n");
+#elif __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int cpu : cpus)
+			if (cpu >= 0 && cpu < CPU_SETSIZE)
+				CPU_SET(cpu, &set);
+		int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (error != 0)
+			fprintf(stderr, "pinThread: %s\n", strerror(error));
+#endif
+	}
 
-		while (true) {
-			{
-				std::lock_guard<std::mutex> lk(_mTerminate);
-				if (_shouldStop) {
-					break;
-				}
+	// ms since an arbitrary fixed point, the time of the timers
+	uint64_t timeNow() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// spin budget of the low latency mode, adapts to the traffic between 1 and spinPolls non blocking polls
+	// a spin that found events doubles it, an empty spin halves it
+	// a block that ended sooner than the empty spin before it took doubles the budget that spin had, spinning longer would have caught it
+	int _spinBudget = 0;
+	std::chrono::steady_clock::duration _spinTime = {}; // how long the last empty spin took
+
+	// polls the pollfds, in low latency mode it spins with non blocking polls before it blocks
+	// blocks until an event arrives or the next timer is due, stopping the server signals the wakeup fd
+	int waitForEvents() {
+		if (!_network.lowLatency || _network.spinPolls <= 0)
+			return sock::pollState(_pollfds.data(), _pollfds.size(), (int)_timers.timeUntilNext());
+
+		auto spinStart = std::chrono::steady_clock::now();
+		for (int i = 0; i < _spinBudget; i++) {
+			int pollCount = sock::pollState(_pollfds.data(), _pollfds.size(), 0);
+			if (pollCount != 0) {
+				_spinBudget = std::min(_spinBudget * 2, _network.spinPolls);
+				return pollCount;
 			}
+		}
+		auto blockStart = std::chrono::steady_clock::now();
+		_spinTime = blockStart - spinStart;
+		_spinBudget = std::max(_spinBudget / 2, 1);
+
+		int pollCount = sock::pollState(_pollfds.data(), _pollfds.size(), (int)_timers.timeUntilNext());
+		if (pollCount > 0 && std::chrono::steady_clock::now() - blockStart < _spinTime)
+			_spinBudget = std::min(_spinBudget * 4, _network.spinPolls);
+		return pollCount;
+	}
+
+	void loop(NetworkData network) {
+		_network = network;
+		if (network.lowLatency)
+			pinThread(network.cpus);
+
+		_handedOff = false;
+		_timers = TimingWheel(timeNow());
+		_spinBudget = network.spinPolls;
+		if (network.takeover)
+			_serverSocket = takeOverServer(network);
+		else
+			_serverSocket = getServerSocket(network);
+		openHandoffListener();
+		openLocalListener();
+		if (network.scheduleUpdates)
+			tick();
+		if (network.simulateInputs) {
+			_simulationStart = _timers.now();
+			simulationStep();
+		}
+		printf("server running\n");
 
-			int pollCount = sock::pollState(_pollfds.data(), _pollfds.size(), 100);// fetch events of the given pollfds
+		while (!_shouldStop.load(std::memory_order_acquire)) {
+			int pollCount = waitForEvents(); // fetch events of the given pollfds
+			_timers.advance(timeNow()); // fire the timers that are due
 			if (pollCount == 0)
 				continue;
 
 			if (pollCount == -1) {
+				if (sock::lastError() == EINTR)
+					continue;
 				sock::printLastError("poll");
 				exit(sock::lastError());
 			}
@@ -815,25 +2485,40 @@ namespace server {
 		freeResources();
 
 		printf("server done\n");
+
+		if (_handedOff) { // the new server runs now, this process has nothing left to do
+			finishHandOff();
+			printf("handed off to the new server, exiting\n");
+			fflush(stdout);
+#ifdef __linux__
+			_exit(0);
+#endif
+		}
 	}
 }
 
 void runServer(NetworkData network) {
 	if (server::_isRunning)
 		return;
+	if (network.filterMoves && network.scheduleUpdates) { // the filter predicts like a client that got every relayed move, the scheduler skips moves per client
+		fprintf(stderr, "the move filter can't be combined with the send scheduler\n");
+		exit(1);
+	}
 	server::_isRunning = true;
 
 	server::_shouldStop = false;
+	if ((server::_wakeup = sock::createWakeup()) == -1) {
+		sock::printLastError("createWakeup");
+		exit(sock::lastError());
+	}
 	server::_thread = std::thread(server::loop, network);
 }
 
 void terminateServer() {
 	if (!server::_isRunning)
 		return;
-	{
-		std::lock_guard<std::mutex> lk(server::_mTerminate);
-		server::_shouldStop = true;
-	}
+	server::_shouldStop.store(true, std::memory_order_release);
+	sock::signalWakeup(server::_wakeup); // wake the loop up immediately instead of waiting for a poll timeout
 	server::_thread.join();
 	server::_shouldStop = false;
 	server::_isRunning = false;
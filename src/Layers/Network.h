@@ -4,6 +4,8 @@
 
 // starts the server thread
 // takes a copy of the network data, this cannot be changed while the server is running, needs a restart
+// to restart without dropping clients, start the new server with network.takeover and the same network.handoffPath
+// the running server then hands its sockets and clients over and exits the process
 void runServer(NetworkData network);
 
 void terminateServer();
\ No newline at end of file
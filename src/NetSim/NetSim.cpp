@@ -0,0 +1,601 @@
+// VOD_NetSim, a loopback proxy between clients and VOD_Server that impairs the traffic
+// clients connect to the proxy instead of the server, every client gets its own connection to the server
+// the server knows the udp address of a client by the address of its tcp connection,
+// so the proxy sends the datagrams of a client from a udp socket bound to the address of its tcp connection to the server
+//
+// impairments are set per direction (up: client to server, down: server to client)
+// latency, jitter and bandwidth apply to both tcp and udp, loss, duplication and reordering only to udp
+// jitter never reorders packets, only the reorder impairment does
+
+#include "Objects/TimingWheel.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+
+#define NETSIM_BUFFER_SIZE 65536
+
+namespace netsim {
+	enum Direction {
+		eUP = 0, // client to server
+		eDOWN = 1 // server to client
+	};
+
+	enum Protocol {
+		eTCP = 0,
+		eUDP = 1
+	};
+
+	const char* directionName(int direction) { return direction == eUP ? "up" : "down"; }
+	const char* protocolName(int protocol) { return protocol == eTCP ? "tcp" : "udp"; }
+
+	struct Impairment {
+		int latency = 0; // ms
+		int jitter = 0; // ms, the delay is latency +- jitter
+		float loss = 0.0f; // percent of datagrams
+		float duplicate = 0.0f; // percent of datagrams
+		float reorder = 0.0f; // percent of datagrams that are held back by reorderDelay, so later ones overtake them
+		int reorderDelay = 20; // ms
+		int bandwidth = 0; // kbit/s, 0 is unlimited
+		int queue = 500; // ms, datagrams that would wait longer for the bandwidth are dropped
+	};
+
+	struct Stats {
+		uint64_t packets = 0; // forwarded, tcp counts the chunks that were read
+		uint64_t bytes = 0;
+		uint64_t lost = 0;
+		uint64_t duplicated = 0;
+		uint64_t reordered = 0;
+		uint64_t queueDrops = 0;
+		uint64_t totalDelay = 0; // ms, added by the proxy
+		uint64_t maxDelay = 0;
+	};
+
+	struct Delayed {
+		uint64_t deliverTime; // ms
+		uint64_t arrivalTime;
+		int protocol;
+		std::vector<char> data; // empty tcp data closes the session
+	};
+
+	struct Link { // one direction of a session, tcp and udp share it like they share a real connection
+		std::deque<Delayed> queue = {}; // in delivery order
+		uint64_t lastDelivery = 0;
+		double linkFree = 0.0; // ms, when the bandwidth is available again
+	};
+
+	struct Session {
+		int client = -1; // tcp socket to the client
+		int server = -1; // tcp socket to the server
+		int dgram = -1; // udp socket to the server, bound to the address of the server tcp socket
+		sockaddr_in clientAddr = {}; // tcp and udp address of the client
+		Link links[2];
+	};
+
+	struct Phase { // a line of the script
+		uint64_t time; // ms after the start
+		int direction; // eUP, eDOWN or -1 for both
+		std::vector<std::pair<std::string, std::string>> settings;
+		bool end = false;
+	};
+
+	volatile sig_atomic_t _shouldStop = 0;
+	int _listenStream = -1;
+	int _listenDgram = -1;
+	sockaddr_in _serverAddr = {};
+	Impairment _impairments[2];
+	Stats _stats[2][2] = {}; // [direction][protocol]
+	uint64_t _connections = 0;
+	uint64_t _unrouted = 0; // datagrams of clients without a tcp connection
+	std::unordered_map<uint32_t, Session> _sessions = {};
+	std::unordered_map<uint64_t, uint32_t> _sessionAddrs = {}; // client address to session id
+	uint32_t _nextSessionId = 1;
+	TimingWheel _timers;
+	uint64_t _start = 0;
+	std::mt19937 _random;
+
+	uint64_t timeNow() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	uint64_t addrKey(const sockaddr_in& addr) {
+		return ((uint64_t)addr.sin_addr.s_addr << 16) | addr.sin_port;
+	}
+
+	bool chance(float percent) {
+		return percent > 0.0f && std::uniform_real_distribution<float>(0.0f, 100.0f)(_random) < percent;
+	}
+
+	// returns false if the key is unknown or the value invalid
+	bool setImpairment(Impairment& impairment, const std::string& key, const std::string& value) {
+		char* end;
+		double number = strtod(value.c_str(), &end);
+		if (value.empty() || *end != '\0' || number < 0)
+			return false;
+		if (key == "latency")
+			impairment.latency = (int)number;
+		else if (key == "jitter")
+			impairment.jitter = (int)number;
+		else if (key == "loss")
+			impairment.loss = (float)number;
+		else if (key == "duplicate")
+			impairment.duplicate = (float)number;
+		else if (key == "reorder")
+			impairment.reorder = (float)number;
+		else if (key == "reorder-delay")
+			impairment.reorderDelay = (int)number;
+		else if (key == "bandwidth")
+			impairment.bandwidth = (int)number;
+		else if (key == "queue")
+			impairment.queue = (int)number;
+		else
+			return false;
+		return true;
+	}
+
+	void printImpairments() {
+		for (int direction = eUP; direction <= eDOWN; direction++) {
+			const Impairment& i = _impairments[direction];
+			printf("  %-4s latency %d ms, jitter %d ms, loss %.1f%%, duplicate %.1f%%, reorder %.1f%% by %d ms, bandwidth %d kbit/s, queue %d ms\n",
+				directionName(direction), i.latency, i.jitter, i.loss, i.duplicate, i.reorder, i.reorderDelay, i.bandwidth, i.queue);
+		}
+	}
+
+	void printReport() {
+		printf("netsim report after %.1f s, %llu connections, %llu unrouted datagrams\n",
+			(timeNow() - _start) / 1000.0, (unsigned long long)_connections, (unsigned long long)_unrouted);
+		for (int direction = eUP; direction <= eDOWN; direction++)
+			for (int protocol = eTCP; protocol <= eUDP; protocol++) {
+				const Stats& s = _stats[direction][protocol];
+				printf("  %-4s %s: %llu packets, %llu bytes, %llu lost, %llu duplicated, %llu reordered, %llu queue drops, delay avg %.1f ms max %llu ms\n",
+					directionName(direction), protocolName(protocol),
+					(unsigned long long)s.packets, (unsigned long long)s.bytes, (unsigned long long)s.lost, (unsigned long long)s.duplicated,
+					(unsigned long long)s.reordered, (unsigned long long)s.queueDrops,
+					s.packets ? (double)s.totalDelay / s.packets : 0.0, (unsigned long long)s.maxDelay);
+			}
+		fflush(stdout);
+	}
+
+	void closeSession(uint32_t id) {
+		auto it = _sessions.find(id);
+		if (it == _sessions.end())
+			return;
+		Session& session = it->second;
+		close(session.client);
+		close(session.server);
+		close(session.dgram);
+		_sessionAddrs.erase(addrKey(session.clientAddr));
+		_sessions.erase(it);
+	}
+
+	// sends the data to its destination, tcp sends block, the proxy is only meant for loopback tests
+	void deliver(uint32_t id, int direction, Delayed& delayed) {
+		auto it = _sessions.find(id);
+		if (it == _sessions.end())
+			return;
+		Session& session = it->second;
+
+		if (delayed.protocol == eTCP && delayed.data.empty()) { // the other side closed its stream
+			closeSession(id);
+			return;
+		}
+
+		Stats& stats = _stats[direction][delayed.protocol];
+		uint64_t delay = delayed.deliverTime - delayed.arrivalTime;
+		stats.totalDelay += delay;
+		stats.maxDelay = std::max(stats.maxDelay, delay);
+
+		if (delayed.protocol == eUDP) {
+			if (direction == eUP)
+				send(session.dgram, delayed.data.data(), delayed.data.size(), 0);
+			else
+				sendto(_listenDgram, delayed.data.data(), delayed.data.size(), 0, reinterpret_cast<sockaddr*>(&session.clientAddr), sizeof(sockaddr_in));
+			return;
+		}
+
+		int stream = direction == eUP ? session.server : session.client;
+		size_t offset = 0;
+		while (offset < delayed.data.size()) {
+			ssize_t bytesSent = send(stream, delayed.data.data() + offset, delayed.data.size() - offset, MSG_NOSIGNAL);
+			if (bytesSent <= 0) {
+				closeSession(id);
+				return;
+			}
+			offset += bytesSent;
+		}
+	}
+
+	void flushLink(uint32_t id, int direction) {
+		auto it = _sessions.find(id);
+		if (it == _sessions.end())
+			return;
+		Link& link = it->second.links[direction];
+		uint64_t now = _timers.now();
+		while (!link.queue.empty() && link.queue.front().deliverTime <= now) {
+			Delayed delayed = std::move(link.queue.front());
+			link.queue.pop_front();
+			deliver(id, direction, delayed);
+			if (!_sessions.count(id)) // closed by the delivery
+				return;
+		}
+	}
+
+	// applies the impairments of the direction and queues the data for delivery
+	void submit(uint32_t id, int direction, int protocol, const char* data, size_t size) {
+		Session& session = _sessions[id];
+		Link& link = session.links[direction];
+		const Impairment& impairment = _impairments[direction];
+		Stats& stats = _stats[direction][protocol];
+		uint64_t now = _timers.now();
+
+		int copies = 1;
+		if (protocol == eUDP) {
+			if (chance(impairment.loss)) {
+				stats.lost++;
+				return;
+			}
+			if (chance(impairment.duplicate)) {
+				stats.duplicated++;
+				copies = 2;
+			}
+		}
+
+		for (int copy = 0; copy < copies; copy++) {
+			double sendTime = (double)now;
+			if (impairment.bandwidth > 0) { // kbit/s is bits per ms
+				double start = std::max(sendTime, link.linkFree);
+				if (protocol == eUDP && start - now > impairment.queue) {
+					stats.queueDrops++;
+					continue;
+				}
+				link.linkFree = start + size * 8.0 / impairment.bandwidth;
+				sendTime = link.linkFree;
+			}
+			int jitter = impairment.jitter > 0 ? std::uniform_int_distribution<int>(-impairment.jitter, impairment.jitter)(_random) : 0;
+			uint64_t deliverTime = (uint64_t)std::max(sendTime + std::max(0, impairment.latency + jitter), (double)now);
+
+			stats.packets++;
+			stats.bytes += size;
+			Delayed delayed = { deliverTime, now, protocol, std::vector<char>(data, data + size) };
+
+			if (protocol == eUDP && chance(impairment.reorder)) { // skips the queue, so the packets after it overtake it
+				stats.reordered++;
+				delayed.deliverTime += impairment.reorderDelay;
+				_timers.schedule(delayed.deliverTime, [id, direction, delayed]() mutable { deliver(id, direction, delayed); });
+				continue;
+			}
+
+			deliverTime = std::max(deliverTime, link.lastDelivery); // keeps the order, jitter alone doesn't reorder
+			delayed.deliverTime = deliverTime;
+			link.lastDelivery = deliverTime;
+			link.queue.push_back(std::move(delayed));
+			_timers.schedule(deliverTime, [id, direction]() { flushLink(id, direction); });
+		}
+	}
+
+	void submitClose(uint32_t id, int direction) {
+		Link& link = _sessions[id].links[direction];
+		uint64_t deliverTime = std::max(_timers.now(), link.lastDelivery);
+		link.queue.push_back({ deliverTime, deliverTime, eTCP, {} });
+		_timers.schedule(deliverTime, [id, direction]() { flushLink(id, direction); });
+	}
+
+	void acceptClient() {
+		Session session;
+		socklen_t addrSize = sizeof(sockaddr_in);
+		if ((session.client = accept(_listenStream, reinterpret_cast<sockaddr*>(&session.clientAddr), &addrSize)) == -1) {
+			perror("accept");
+			return;
+		}
+
+		// the server takes the address of this connection as the udp address of the client
+		sockaddr_in localAddr;
+		socklen_t localSize = sizeof(sockaddr_in);
+		if ((session.server = socket(AF_INET, SOCK_STREAM, 0)) == -1 ||
+			connect(session.server, reinterpret_cast<sockaddr*>(&_serverAddr), sizeof(sockaddr_in)) == -1 ||
+			getsockname(session.server, reinterpret_cast<sockaddr*>(&localAddr), &localSize) == -1 ||
+			(session.dgram = socket(AF_INET, SOCK_DGRAM, 0)) == -1 ||
+			bind(session.dgram, reinterpret_cast<sockaddr*>(&localAddr), sizeof(sockaddr_in)) == -1 ||
+			connect(session.dgram, reinterpret_cast<sockaddr*>(&_serverAddr), sizeof(sockaddr_in)) == -1) {
+			perror("connect to server");
+			close(session.client);
+			close(session.server);
+			close(session.dgram);
+			return;
+		}
+		int yes = 1;
+		setsockopt(session.client, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+		setsockopt(session.server, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+		uint32_t id = _nextSessionId++;
+		_sessionAddrs[addrKey(session.clientAddr)] = id;
+		_sessions[id] = session;
+		_connections++;
+	}
+
+	void recvStream(uint32_t id, int direction) {
+		static char buf[NETSIM_BUFFER_SIZE];
+		Session& session = _sessions[id];
+		int stream = direction == eUP ? session.client : session.server;
+		ssize_t bytesRead = recv(stream, buf, sizeof(buf), 0);
+		if (bytesRead <= 0) {
+			submitClose(id, direction);
+			if (direction == eUP)
+				session.client = (close(session.client), -1); // nothing more to read, the queued data is still delivered
+			else
+				session.server = (close(session.server), -1);
+			return;
+		}
+		submit(id, direction, eTCP, buf, bytesRead);
+	}
+
+	void recvClientDgram() {
+		char buf[NETSIM_BUFFER_SIZE];
+		sockaddr_in addr;
+		socklen_t addrSize = sizeof(sockaddr_in);
+		ssize_t bytesRead = recvfrom(_listenDgram, buf, sizeof(buf), 0, reinterpret_cast<sockaddr*>(&addr), &addrSize);
+		if (bytesRead < 0)
+			return;
+		auto it = _sessionAddrs.find(addrKey(addr));
+		if (it == _sessionAddrs.end()) {
+			_unrouted++;
+			return;
+		}
+		submit(it->second, eUP, eUDP, buf, bytesRead);
+	}
+
+	void recvServerDgram(uint32_t id) {
+		char buf[NETSIM_BUFFER_SIZE];
+		ssize_t bytesRead = recv(_sessions[id].dgram, buf, sizeof(buf), 0);
+		if (bytesRead < 0)
+			return;
+		submit(id, eDOWN, eUDP, buf, bytesRead);
+	}
+
+	// returns false if the script can't be read
+	bool loadScript(const std::string& path, std::vector<Phase>& phases) {
+		std::ifstream file(path);
+		if (!file)
+			return false;
+		std::string line;
+		int lineNumber = 0;
+		while (std::getline(file, line)) {
+			lineNumber++;
+			line = line.substr(0, line.find('#'));
+			std::istringstream words(line);
+			double seconds;
+			std::string direction;
+			if (!(words >> seconds))
+				continue; // empty or comment
+			if (!(words >> direction)) {
+				fprintf(stderr, "%s:%d: missing direction\n", path.c_str(), lineNumber);
+				return false;
+			}
+
+			Phase phase;
+			phase.time = (uint64_t)(seconds * 1000.0);
+			phase.direction = direction == "up" ? eUP : direction == "down" ? eDOWN : -1;
+			phase.end = direction == "end";
+			if (phase.direction == -1 && direction != "both" && !phase.end) {
+				fprintf(stderr, "%s:%d: unknown direction %s\n", path.c_str(), lineNumber, direction.c_str());
+				return false;
+			}
+			std::string setting;
+			while (words >> setting) {
+				size_t equals = setting.find('=');
+				Impairment test;
+				if (equals == std::string::npos || !setImpairment(test, setting.substr(0, equals), setting.substr(equals + 1))) {
+					fprintf(stderr, "%s:%d: invalid setting %s\n", path.c_str(), lineNumber, setting.c_str());
+					return false;
+				}
+				phase.settings.push_back({ setting.substr(0, equals), setting.substr(equals + 1) });
+			}
+			phases.push_back(phase);
+		}
+		return true;
+	}
+
+	void applyPhase(const Phase& phase) {
+		if (phase.end) {
+			printf("netsim: script ended at %.1f s\n", phase.time / 1000.0);
+			_shouldStop = 1;
+			return;
+		}
+		for (int direction = eUP; direction <= eDOWN; direction++)
+			if (phase.direction == -1 || phase.direction == direction)
+				for (const auto& [key, value] : phase.settings)
+					setImpairment(_impairments[direction], key, value);
+		printf("netsim: %.1f s, impairments changed\n", phase.time / 1000.0);
+		printImpairments();
+		if (phase.time > 0)
+			printReport(); // what the previous phase injected
+	}
+
+	void report(uint64_t interval) {
+		printReport();
+		_timers.schedule(_timers.now() + interval, [interval]() { report(interval); });
+	}
+
+	int openListener(int type, int port) {
+		int fd = socket(AF_INET, type, 0);
+		int yes = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+		sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(port);
+		if (fd == -1 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1 || (type == SOCK_STREAM && listen(fd, 128) == -1)) {
+			perror("listen");
+			exit(1);
+		}
+		return fd;
+	}
+
+	void stop(int) {
+		_shouldStop = 1;
+	}
+
+	void loop() {
+		std::vector<pollfd> pollfds;
+		std::vector<std::pair<uint32_t, int>> owners; // session id and what the pollfd is (0: client stream, 1: server stream, 2: server dgram)
+		while (!_shouldStop) {
+			pollfds.clear();
+			owners.clear();
+			pollfds.push_back({ _listenStream, POLLIN, 0 });
+			pollfds.push_back({ _listenDgram, POLLIN, 0 });
+			for (const auto& [id, session] : _sessions) {
+				if (session.client != -1) {
+					pollfds.push_back({ session.client, POLLIN, 0 });
+					owners.push_back({ id, 0 });
+				}
+				if (session.server != -1) {
+					pollfds.push_back({ session.server, POLLIN, 0 });
+					owners.push_back({ id, 1 });
+				}
+				pollfds.push_back({ session.dgram, POLLIN, 0 });
+				owners.push_back({ id, 2 });
+			}
+
+			int pollCount = poll(pollfds.data(), pollfds.size(), (int)_timers.timeUntilNext());
+			_timers.advance(timeNow() - _start);
+			if (pollCount <= 0)
+				continue;
+
+			if (pollfds[0].revents & POLLIN)
+				acceptClient();
+			if (pollfds[1].revents & POLLIN)
+				recvClientDgram();
+			for (size_t i = 2; i < pollfds.size(); i++) {
+				if (!(pollfds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+					continue;
+				auto [id, kind] = owners[i - 2];
+				if (!_sessions.count(id)) // closed by an earlier event
+					continue;
+				if (kind == 2)
+					recvServerDgram(id);
+				else
+					recvStream(id, kind == 0 ? eUP : eDOWN);
+			}
+		}
+	}
+}
+
+void printUsage() {
+	printf(
+		"usage: VOD_NetSim [options]\n"
+		"  --listen <port>          port the clients connect to (default 13601)\n"
+		"  --server <port>          port of VOD_Server on localhost (default 12525)\n"
+		"  --<impairment> <value>   sets an impairment for both directions\n"
+		"  --up-<impairment> <v>    only client to server\n"
+		"  --down-<impairment> <v>  only server to client\n"
+		"  --script <file>          lines of \"<seconds> <up|down|both> <impairment>=<value>...\" or \"<seconds> end\"\n"
+		"  --report <seconds>       prints what was injected every few seconds, it's always printed on exit\n"
+		"  --duration <seconds>     stops after this time\n"
+		"  --seed <n>               seed of the random impairments (default 1)\n"
+		"impairments: latency, jitter, reorder-delay, queue (ms), loss, duplicate, reorder (percent), bandwidth (kbit/s)\n");
+}
+
+int main(int argc, char** argv) {
+	using namespace netsim;
+
+	int listenPort = 13601;
+	int serverPort = 12525; // NetworkData::port
+	double reportInterval = 0;
+	double duration = 0;
+	unsigned int seed = 1;
+	std::vector<Phase> phases;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (i + 1 >= argc || arg.rfind("--", 0) != 0) {
+			printUsage();
+			return 1;
+		}
+		std::string value = argv[++i];
+		std::string key = arg.substr(2);
+		if (key == "listen")
+			listenPort = atoi(value.c_str());
+		else if (key == "server")
+			serverPort = atoi(value.c_str());
+		else if (key == "report")
+			reportInterval = atof(value.c_str());
+		else if (key == "duration")
+			duration = atof(value.c_str());
+		else if (key == "seed")
+			seed = (unsigned int)strtoul(value.c_str(), nullptr, 10);
+		else if (key == "script") {
+			if (!loadScript(value, phases)) {
+				fprintf(stderr, "can't load script %s\n", value.c_str());
+				return 1;
+			}
+		}
+		else {
+			bool valid;
+			if (key.rfind("up-", 0) == 0)
+				valid = setImpairment(_impairments[eUP], key.substr(3), value);
+			else if (key.rfind("down-", 0) == 0)
+				valid = setImpairment(_impairments[eDOWN], key.substr(5), value);
+			else
+				valid = setImpairment(_impairments[eUP], key, value) && setImpairment(_impairments[eDOWN], key, value);
+			if (!valid) {
+				fprintf(stderr, "invalid argument %s %s\n", arg.c_str(), value.c_str());
+				printUsage();
+				return 1;
+			}
+		}
+	}
+
+	struct sigaction action = {};
+	action.sa_handler = stop;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+	signal(SIGPIPE, SIG_IGN);
+
+	_random.seed(seed);
+	_serverAddr.sin_family = AF_INET;
+	_serverAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	_serverAddr.sin_port = htons(serverPort);
+	_listenStream = openListener(SOCK_STREAM, listenPort);
+	_listenDgram = openListener(SOCK_DGRAM, listenPort);
+
+	_start = timeNow();
+	_timers = TimingWheel(0); // ms since the start
+	for (const Phase& phase : phases)
+		_timers.schedule(phase.time, [phase]() { applyPhase(phase); });
+	if (reportInterval > 0)
+		_timers.schedule((uint64_t)(reportInterval * 1000.0), [reportInterval]() { report((uint64_t)(reportInterval * 1000.0)); });
+	if (duration > 0)
+		_timers.schedule((uint64_t)(duration * 1000.0), []() { _shouldStop = 1; });
+
+	printf("netsim: %d -> %d\n", listenPort, serverPort);
+	printImpairments();
+	fflush(stdout);
+	loop();
+
+	std::vector<uint32_t> ids;
+	for (const auto& [id, session] : _sessions)
+		ids.push_back(id);
+	for (uint32_t id : ids)
+		closeSession(id);
+	close(_listenStream);
+	close(_listenDgram);
+	printReport();
+	return 0;
+}
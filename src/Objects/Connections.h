@@ -0,0 +1,162 @@
+#pragma once
+
+#include "TimingWheel.h"
+
+#include <coroutine>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// the connections of a reactor that handles every client stream with a coroutine (a Task)
+// the coroutines await their frames with recvFrame and pause with sleepFor, all of them run on the reactor thread
+// steady state doesn't allocate, the frame queue of a connection keeps its capacity
+// used by the server (see server::handleConnection) and by the coroutine benchmark
+template<typename Packet>
+class Connections {
+public:
+	struct Frame { // a packet received on a client stream
+		int type = 0;
+		std::shared_ptr<Packet> spPacket; // nullptr if the connection closed
+	};
+
+	struct Connection { // state shared between the reactor and the coroutine of a client
+		std::coroutine_handle<> handle = nullptr; // the suspended coroutine, nullptr while it runs
+		bool waitingForFrame = false; // suspended in recvFrame, otherwise in sleepFor
+		bool closed = false; // the client was disconnected while its coroutine was running
+		std::vector<Frame> frames = {}; // received but not yet awaited frames, consumed from nextFrame
+		size_t nextFrame = 0;
+		TimingWheel::TimerId sleepTimer = 0;
+		std::vector<char> received = {}; // stream bytes of a packet that didn't arrive completely yet
+	};
+
+	// co_await recvFrame(connection) returns the next frame of the client
+	struct RecvFrame {
+		Connection* connection;
+
+		bool await_ready() {
+			return connection->closed || connection->nextFrame < connection->frames.size();
+		}
+		void await_suspend(std::coroutine_handle<> handle) {
+			connection->handle = handle;
+			connection->waitingForFrame = true;
+		}
+		Frame await_resume() {
+			if (connection->nextFrame >= connection->frames.size())
+				return {}; // closed
+			Frame frame = std::move(connection->frames[connection->nextFrame++]);
+			if (connection->nextFrame == connection->frames.size()) { // keeps the capacity, so steady state doesn't allocate
+				connection->frames.clear();
+				connection->nextFrame = 0;
+			}
+			return frame;
+		}
+	};
+
+	// co_await sleepFor(connection, ms) resumes the coroutine after ms, frames that arrive meanwhile are queued
+	struct Sleep {
+		TimingWheel* timers;
+		Connection* connection;
+		uint64_t ms;
+
+		bool await_ready() { return ms == 0; }
+		void await_suspend(std::coroutine_handle<> handle) {
+			connection->handle = handle;
+			connection->waitingForFrame = false;
+			Connection* c = connection;
+			connection->sleepTimer = timers->schedule(timers->now() + ms, [c]() {
+				c->sleepTimer = 0;
+				std::coroutine_handle<> handle = c->handle;
+				c->handle = nullptr;
+				handle.resume();
+			});
+		}
+		void await_resume() {}
+	};
+
+	// lives in the coroutine frame, removes the connection when the coroutine finishes or is destroyed
+	struct Guard {
+		Connections* connections;
+		uint32_t id;
+
+		~Guard() {
+			auto it = connections->_connections.find(id);
+			if (it == connections->_connections.end())
+				return;
+			connections->_timers.cancel(it->second.sleepTimer);
+			connections->_connections.erase(it);
+		}
+	};
+
+	// the sleep timers are scheduled on timers
+	Connections(TimingWheel& timers) : _timers(timers) {}
+
+	// adds the connection of id, call it before starting the coroutine of the client
+	Connection& open(uint32_t id) {
+		Connection& connection = _connections[id];
+		connection.frames.reserve(4);
+		return connection;
+	}
+
+	// nullptr if the connection doesn't exist (anymore)
+	Connection* find(uint32_t id) {
+		auto it = _connections.find(id);
+		return it != _connections.end() ? &it->second : nullptr;
+	}
+
+	RecvFrame recvFrame(Connection& connection) {
+		return { &connection };
+	}
+
+	Sleep sleepFor(Connection& connection, uint64_t ms) {
+		return { &_timers, &connection, ms };
+	}
+
+	Guard guard(uint32_t id) {
+		return { this, id };
+	}
+
+	// hands a received frame to the coroutine of the client, resumes it if it waits for one
+	void deliverFrame(uint32_t id, Frame frame) {
+		Connection* connection = find(id);
+		if (!connection)
+			return;
+		connection->frames.push_back(std::move(frame));
+		if (connection->handle && connection->waitingForFrame) {
+			std::coroutine_handle<> handle = connection->handle;
+			connection->handle = nullptr;
+			connection->waitingForFrame = false;
+			handle.resume();
+		}
+	}
+
+	// ends the coroutine of the client, a suspended one is destroyed, a running one sees closed in its next recvFrame
+	void close(uint32_t id) {
+		Connection* connection = find(id);
+		if (!connection)
+			return;
+		if (connection->handle)
+			connection->handle.destroy(); // the Guard in the frame erases the connection
+		else
+			connection->closed = true;
+	}
+
+	// destroys all suspended coroutines and removes all connections
+	void clear() {
+		std::vector<std::coroutine_handle<>> handles;
+		for (const auto& [id, connection] : _connections)
+			if (connection.handle)
+				handles.push_back(connection.handle);
+		for (auto handle : handles) // the guards erase the connections
+			handle.destroy();
+		_connections.clear();
+	}
+
+	size_t size() const {
+		return _connections.size();
+	}
+
+private:
+	TimingWheel& _timers;
+	std::unordered_map<uint32_t, Connection> _connections = {}; // client id -> connection, node based so the coroutines can keep pointers
+};
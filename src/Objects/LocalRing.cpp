@@ -0,0 +1,89 @@
+#include "LocalRing.h"
+
+#include <cstring>
+#include <new>
+
+namespace {
+	uint32_t alignRecord(uint32_t size) {
+		return (size + 3) & ~3u;
+	}
+}
+
+LocalRing::LocalRing(void* memory, uint32_t capacity, bool create)
+	: _header(reinterpret_cast<Header*>(memory)),
+	_data(reinterpret_cast<char*>(memory) + sizeof(Header)),
+	_mask(capacity - 1)
+{
+	if (create) {
+		new (_header) Header();
+		_header->head.store(0, std::memory_order_relaxed);
+		_header->tail.store(0, std::memory_order_relaxed);
+		_header->capacity = capacity;
+	}
+}
+
+bool LocalRing::push(const char* data, uint32_t size, bool& wasEmpty) {
+	uint32_t capacity = _mask + 1;
+	uint32_t recordSize = alignRecord(sizeof(uint32_t) + size);
+	uint64_t tail = _header->tail.load(std::memory_order_relaxed);
+	uint64_t head = _header->head.load(std::memory_order_acquire);
+
+	uint64_t start = tail;
+	uint32_t offset = (uint32_t)(tail & _mask);
+	uint32_t padding = capacity - offset < recordSize ? capacity - offset : 0; // the record has to be contiguous
+	wasEmpty = false;
+	if (tail - head > capacity) // the consumer wrote a head it can't have reached, don't trust it like pop
+		return false;
+	if (recordSize + padding > capacity - (tail - head))
+		return false;
+
+	if (padding) {
+		memcpy(_data + offset, &PADDING, sizeof(uint32_t));
+		tail += padding;
+		offset = 0;
+	}
+	memcpy(_data + offset, &size, sizeof(uint32_t));
+	memcpy(_data + offset + sizeof(uint32_t), data, size);
+
+	// seq_cst pairs with the consumer in pop, either it sees this record or this sees that it emptied the ring
+	_header->tail.store(tail + recordSize, std::memory_order_seq_cst);
+	wasEmpty = _header->head.load(std::memory_order_seq_cst) == start;
+	return true;
+}
+
+uint32_t LocalRing::pop(char* buf, uint32_t bufSize) {
+	uint64_t head = _header->head.load(std::memory_order_relaxed);
+	while (true) {
+		uint64_t tail = _header->tail.load(std::memory_order_seq_cst);
+		if (head == tail)
+			return 0;
+
+		// the other process can write anything into the shared memory, so every read is checked against the capacity
+		uint32_t capacity = _mask + 1;
+		uint32_t offset = (uint32_t)(head & _mask);
+		if (tail - head > capacity || offset + sizeof(uint32_t) > capacity) {
+			_header->head.store(tail, std::memory_order_seq_cst);
+			return 0;
+		}
+		uint32_t size;
+		memcpy(&size, _data + offset, sizeof(uint32_t));
+		if (size == PADDING) {
+			head += capacity - offset;
+			_header->head.store(head, std::memory_order_seq_cst);
+			continue;
+		}
+
+		uint32_t recordSize = alignRecord(sizeof(uint32_t) + size);
+		if (size > capacity || recordSize > tail - head || offset + recordSize > capacity) { // a broken producer, drop everything it wrote
+			_header->head.store(tail, std::memory_order_seq_cst);
+			return 0;
+		}
+		bool fits = size <= bufSize;
+		if (fits)
+			memcpy(buf, _data + offset + sizeof(uint32_t), size);
+		head += recordSize;
+		_header->head.store(head, std::memory_order_seq_cst);
+		if (fits)
+			return size;
+	}
+}
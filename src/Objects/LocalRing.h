@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+// single producer single consumer ring of variable sized records in shared memory
+// one process pushes and another one pops, they only share the head and tail counters
+// a record is [uint32 size][data] aligned to 4 bytes, a record that doesn't fit before the end is preceded by a padding record
+class LocalRing {
+public:
+	static constexpr uint32_t PADDING = UINT32_MAX; // size of a padding record, the rest until the end is skipped
+
+	struct Header {
+		alignas(64) std::atomic<uint64_t> head; // bytes popped, only written by the consumer
+		alignas(64) std::atomic<uint64_t> tail; // bytes pushed, only written by the producer
+		alignas(64) uint32_t capacity;
+	};
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "the counters are shared between processes");
+
+	// bytes of shared memory a ring with the given capacity needs
+	static size_t mappedSize(uint32_t capacity) { return sizeof(Header) + capacity; }
+
+	LocalRing() = default;
+
+	// attaches to a ring at memory, if create is set the ring is initialized first
+	// capacity has to be a power of two and at least 64
+	LocalRing(void* memory, uint32_t capacity, bool create);
+
+	// returns false if the ring is full or the consumer broke the head, the record is dropped then
+	// wasEmpty is set if the consumer had nothing left, only then it has to be woken up
+	bool push(const char* data, uint32_t size, bool& wasEmpty);
+
+	// copies the next record into buf and returns its size, 0 if the ring is empty
+	// records larger than bufSize are skipped
+	uint32_t pop(char* buf, uint32_t bufSize);
+
+	// true if pop has nothing to return, only for the consumer
+	bool empty() const {
+		return _header->head.load(std::memory_order_relaxed) == _header->tail.load(std::memory_order_seq_cst);
+	}
+
+	bool valid() const { return _header != nullptr; }
+
+private:
+	Header* _header = nullptr;
+	char* _data = nullptr;
+	uint32_t _mask = 0;
+};
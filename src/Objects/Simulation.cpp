@@ -0,0 +1,66 @@
+#include "Simulation.h"
+
+#include <cmath>
+
+void Simulation::add(uint16_t session) {
+	if (_indices.count(session))
+		return;
+	_indices[session] = (uint32_t)_players.size();
+	Player player;
+	player.session = session;
+	_players.push_back(player);
+}
+
+void Simulation::remove(uint16_t session) {
+	auto it = _indices.find(session);
+	if (it == _indices.end())
+		return;
+	uint32_t index = it->second;
+	_indices.erase(it);
+
+	// move the last player into the gap, keeps the array contiguous
+	if (index != _players.size() - 1) {
+		_players[index] = _players.back();
+		_indices[_players[index].session] = index;
+	}
+	_players.pop_back();
+}
+
+bool Simulation::applyInput(uint16_t session, const Input& input) {
+	auto it = _indices.find(session);
+	if (it == _indices.end())
+		return false;
+	Player& player = _players[it->second];
+	if (input.sequence <= player.input.sequence)
+		return false;
+	player.input = input;
+	return true;
+}
+
+void Simulation::step(float dt) {
+	for (Player& player : _players) {
+		const Input& input = player.input;
+		player.yaw += turnSpeed * (input.turn / 127.0f) * dt;
+
+		float speed = moveSpeed * (input.buttons & eSPRINT ? 2.0f : 1.0f);
+		float forward = speed * (input.forward / 127.0f);
+		float strafe = speed * (input.strafe / 127.0f);
+		float sinYaw = std::sin(player.yaw), cosYaw = std::cos(player.yaw);
+		player.velocity[0] = forward * sinYaw + strafe * cosYaw;
+		player.velocity[2] = forward * cosYaw - strafe * sinYaw;
+
+		bool grounded = player.position[1] <= 0.0f;
+		if (grounded && (input.buttons & eJUMP))
+			player.velocity[1] = jumpSpeed;
+		else if (!grounded)
+			player.velocity[1] -= gravity * dt;
+
+		for (int i = 0; i < 3; i++)
+			player.position[i] += player.velocity[i] * dt;
+		if (player.position[1] < 0.0f) { // landed
+			player.position[1] = 0.0f;
+			player.velocity[1] = 0.0f;
+		}
+	}
+	_stepCount++;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+
+// fixed step simulation of the players, driven by the input commands of their clients
+// players live in one contiguous array, so a step is a single pass over it
+// a player is identified by the session of its client
+class Simulation {
+public:
+	enum Buttons : uint8_t {
+		eJUMP = 1,
+		eSPRINT = 2
+	};
+
+	struct Input {
+		uint32_t sequence = 0; // increases with every input of a client
+		int8_t forward = 0; // axes, -127 to 127
+		int8_t strafe = 0;
+		int8_t turn = 0;
+		uint8_t buttons = 0; // see Buttons
+	};
+
+	struct Player {
+		float position[3] = {};
+		float velocity[3] = {}; // units per second
+		float yaw = 0.0f; // radians
+		Input input = {}; // the latest input, it's held until a newer one arrives
+		uint16_t session = 0;
+	};
+
+	float moveSpeed = 5.0f; // units per second at full axis
+	float turnSpeed = 3.0f; // radians per second at full axis
+	float jumpSpeed = 5.0f;
+	float gravity = 9.81f;
+
+	void add(uint16_t session);
+	void remove(uint16_t session);
+
+	// returns false if there is no such player or the input is older than the one it has, clients may send inputs more than once
+	bool applyInput(uint16_t session, const Input& input);
+
+	// advances all players by dt seconds
+	void step(float dt);
+
+	const std::vector<Player>& players() const { return _players; }
+	uint32_t stepCount() const { return _stepCount; }
+
+private:
+	std::vector<Player> _players = {};
+	std::unordered_map<uint16_t, uint32_t> _indices = {}; // session to index in _players
+	uint32_t _stepCount = 0;
+};
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+
+// fire and forget coroutine
+// it runs right away until its first suspension and frees its frame when it finishes
+// a suspended Task is resumed by whoever stored its handle, or destroyed through that handle to cancel it
+struct Task {
+	struct promise_type {
+		Task get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
@@ -0,0 +1,173 @@
+#include "TimingWheel.h"
+
+#include <algorithm>
+
+namespace {
+	int lowestBit(uint64_t bits) {
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward64(&index, bits);
+		return (int)index;
+#else
+		return __builtin_ctzll(bits);
+#endif
+	}
+}
+
+TimingWheel::TimingWheel(uint64_t now)
+	: _now(now)
+{
+	std::fill(std::begin(_heads), std::end(_heads), NIL);
+}
+
+TimingWheel::TimerId TimingWheel::schedule(uint64_t expireTime, Callback callback) {
+	uint32_t index;
+	if (!_freeNodes.empty()) {
+		index = _freeNodes.back();
+		_freeNodes.pop_back();
+	}
+	else {
+		index = (uint32_t)_nodes.size();
+		_nodes.emplace_back();
+	}
+
+	Node& node = _nodes[index];
+	node.expireTime = std::max(expireTime, _now + 1);
+	node.callback = std::move(callback);
+	insert(index);
+	_activeCount++;
+
+	return ((TimerId)node.generation << 32) | ((TimerId)index + 1);
+}
+
+bool TimingWheel::cancel(TimerId id) {
+	if (id == 0)
+		return false;
+	uint32_t index = (uint32_t)(id & 0xffffffff) - 1;
+	uint32_t generation = (uint32_t)(id >> 32);
+	if (index >= _nodes.size())
+		return false;
+	Node& node = _nodes[index];
+	if (node.generation != generation || node.slot == NIL)
+		return false;
+
+	unlink(index);
+	release(index);
+	return true;
+}
+
+void TimingWheel::advance(uint64_t now) {
+	while (_now < now) {
+		// jump over ticks that neither fire a timer nor cascade
+		uint64_t blockEnd = (_now | (SLOT_COUNT - 1)) + 1; // next tick that cascades
+		uint64_t pending = _occupied[0] >> (_now & (SLOT_COUNT - 1)) >> 1; // level 0 slots after _now in this block
+		uint64_t next = pending ? _now + 1 + lowestBit(pending) : blockEnd;
+		if (next > now) {
+			_now = now;
+			break;
+		}
+		_now = next;
+
+		if ((_now & (SLOT_COUNT - 1)) == 0) {
+			int top = 1; // highest level that starts a new slot now
+			while (top < LEVEL_COUNT - 1 && ((_now >> (LEVEL_BITS * top)) & (SLOT_COUNT - 1)) == 0)
+				top++;
+			for (int level = top; level >= 1; level--) // top down, a cascade can fill the current slot of the level below
+				cascade(level);
+		}
+		fireSlot((uint32_t)(_now & (SLOT_COUNT - 1)));
+	}
+}
+
+int64_t TimingWheel::timeUntilNext() const {
+	if (_activeCount == 0)
+		return -1;
+
+	// the first occupied slot after the current one, on the lowest level that has one
+	// lower levels always come first, a level only holds timers after the current slot of the level above
+	for (int level = 0; level < LEVEL_COUNT; level++) {
+		int shift = LEVEL_BITS * level;
+		uint64_t current = (_now >> shift) & (SLOT_COUNT - 1);
+		uint64_t after = _occupied[level] >> current >> 1;
+
+		uint64_t slot;
+		if (after)
+			slot = current + 1 + lowestBit(after);
+		else if (level == LEVEL_COUNT - 1 && _occupied[level]) // parked timers on the last level wrap around
+			slot = SLOT_COUNT + lowestBit(_occupied[level]);
+		else
+			continue;
+
+		uint64_t slotStart = (((_now >> shift) & ~(uint64_t)(SLOT_COUNT - 1)) + slot) << shift;
+		return (int64_t)(slotStart - _now);
+	}
+	return -1;
+}
+
+void TimingWheel::insert(uint32_t index) {
+	Node& node = _nodes[index];
+	uint64_t expireTime = node.expireTime;
+
+	int level = 0;
+	while (level < LEVEL_COUNT - 1 &&
+		(expireTime >> (LEVEL_BITS * (level + 1))) != (_now >> (LEVEL_BITS * (level + 1)))) // not in the same block of this level
+		level++;
+
+	uint64_t maxTime = _now + ((uint64_t)1 << (LEVEL_BITS * LEVEL_COUNT)) - 1;
+	if (level == LEVEL_COUNT - 1 && expireTime > maxTime) // out of range, park it in the last slot it can reach and cascade it from there
+		expireTime = maxTime;
+
+	uint32_t slotInLevel = (uint32_t)((expireTime >> (LEVEL_BITS * level)) & (SLOT_COUNT - 1));
+	uint32_t slot = level * SLOT_COUNT + slotInLevel;
+
+	node.slot = slot;
+	node.prev = NIL;
+	node.next = _heads[slot];
+	if (node.next != NIL)
+		_nodes[node.next].prev = index;
+	_heads[slot] = index;
+	_occupied[level] |= (uint64_t)1 << slotInLevel;
+}
+
+void TimingWheel::unlink(uint32_t index) {
+	Node& node = _nodes[index];
+	if (node.prev != NIL)
+		_nodes[node.prev].next = node.next;
+	else
+		_heads[node.slot] = node.next;
+	if (node.next != NIL)
+		_nodes[node.next].prev = node.prev;
+
+	if (_heads[node.slot] == NIL)
+		_occupied[node.slot / SLOT_COUNT] &= ~((uint64_t)1 << (node.slot % SLOT_COUNT));
+	node.slot = NIL;
+	node.prev = NIL;
+	node.next = NIL;
+}
+
+void TimingWheel::release(uint32_t index) {
+	Node& node = _nodes[index];
+	node.callback = nullptr;
+	node.generation++;
+	_freeNodes.push_back(index);
+	_activeCount--;
+}
+
+void TimingWheel::cascade(int level) {
+	uint32_t slot = level * SLOT_COUNT + (uint32_t)((_now >> (LEVEL_BITS * level)) & (SLOT_COUNT - 1));
+	while (_heads[slot] != NIL) {
+		uint32_t index = _heads[slot];
+		unlink(index);
+		insert(index); // lands on a lower level now
+	}
+}
+
+void TimingWheel::fireSlot(uint32_t slot) {
+	while (_heads[slot] != NIL) { // one at a time, callbacks may cancel other timers of this slot
+		uint32_t index = _heads[slot];
+		unlink(index);
+		Callback callback = std::move(_nodes[index].callback);
+		release(index);
+		callback();
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <functional>
+
+// hierarchical timing wheel, schedules callbacks with O(1) schedule, cancel and per tick work
+// times are in ticks, the caller decides what a tick is (the server uses milliseconds)
+// level 0 has one slot per tick, every higher level has slots that are SLOT_COUNT times longer
+// timers move down one level when their slot comes up (cascade) until they fire from level 0
+class TimingWheel {
+public:
+	typedef uint64_t TimerId; // 0 is never a valid id
+	typedef std::function<void()> Callback;
+
+	static constexpr int LEVEL_BITS = 6;
+	static constexpr int SLOT_COUNT = 1 << LEVEL_BITS;
+	static constexpr int LEVEL_COUNT = 4; // covers 2^24 ticks, later timers are cascaded until they're in range
+
+	TimingWheel(uint64_t now = 0);
+
+	// calls callback once the wheel is advanced to expireTime or later
+	// times that already passed fire on the next advance
+	TimerId schedule(uint64_t expireTime, Callback callback);
+
+	// returns false if the timer already fired or was cancelled
+	bool cancel(TimerId id);
+
+	// fires all timers up to now, callbacks may schedule and cancel timers
+	void advance(uint64_t now);
+
+	// returns the ticks until the wheel has to be advanced next, -1 if there are no timers
+	// this can be earlier than the next expiry when timers need to cascade
+	int64_t timeUntilNext() const;
+
+	uint64_t now() const { return _now; }
+	size_t size() const { return _activeCount; }
+
+private:
+	static constexpr uint32_t NIL = UINT32_MAX;
+
+	struct Node {
+		uint64_t expireTime = 0;
+		Callback callback;
+		uint32_t prev = NIL;
+		uint32_t next = NIL;
+		uint32_t slot = NIL; // index in _heads, NIL if not scheduled
+		uint32_t generation = 0; // incremented on every reuse, so old ids can't cancel a new timer
+	};
+
+	uint64_t _now;
+	size_t _activeCount = 0;
+	std::vector<Node> _nodes = {};
+	std::vector<uint32_t> _freeNodes = {};
+	uint32_t _heads[LEVEL_COUNT * SLOT_COUNT];
+	uint64_t _occupied[LEVEL_COUNT] = {}; // bit per slot, set if the slot has timers
+
+	void insert(uint32_t index);
+	void unlink(uint32_t index);
+	void release(uint32_t index);
+	void cascade(int level);
+	void fireSlot(uint32_t slot);
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 struct NetworkData {
 	std::string username = "user"; // this username serves as an id for the client
@@ -9,4 +10,53 @@ struct NetworkData {
 
 	// server specific
 	int backlog = 10;
-};
\ No newline at end of file
+
+	// input simulation, clients send input commands instead of transforms and the server simulates the players
+	// moves of clients are ignored, the server broadcasts the simulated state instead
+	bool simulateInputs = false;
+	int simulationRate = 60; // steps per second
+	int snapshotRate = 20; // state broadcasts per second
+
+	// dgram steering, the server opens this many SO_REUSEPORT dgram sockets (shards) on the port
+	// a bpf program in the kernel steers every datagram to the shard of its client, using the session in the packet header
+	// only supported on linux
+	int dgramShards = 1;
+
+	// shared memory transport for clients on the same machine, eg. bots, disabled if localPath is empty
+	// local clients connect to the unix socket at localPath and use it like the tcp stream
+	// their dgram packets go through a pair of shared memory rings of localRingSize bytes each instead of udp
+	// only supported on linux
+	std::string localPath = "";
+	uint32_t localRingSize = 65536; // power of two that fits the largest dgram packet, so at least 2048
+
+	// hot restart, a running server hands its sockets and clients over to a new server process through a unix socket
+	// only supported on linux
+	std::string handoffPath = ""; // the unix socket the running server listens on for a new server, empty disables it
+	bool takeover = false; // instead of opening new sockets, take them over from the server listening on handoffPath
+
+	// timers, 0 disables them
+	int idleTimeout = 0; // ms without any packet from a client until it gets disconnected
+	int heartbeatInterval = 0; // ms between pings the server sends to every client, clients have to know ePING
+
+	// latency profile, trades cpu time for lower and more stable relay latency
+	bool lowLatency = false; // enables the options below
+	int spinPolls = 1000; // most non blocking polls before the network thread blocks in poll, it spins less while spinning finds no traffic, 0 disables spinning
+	int busyPollMicroseconds = 50; // SO_BUSY_POLL on the server sockets, 0 disables it (linux only)
+	std::vector<int> cpus = {}; // the network thread gets pinned to these cpus, empty disables pinning
+
+	// send scheduler, instead of relaying every move to every client right away
+	// the server sends each client the most important updates once per tick, limited by a byte budget
+	bool scheduleUpdates = false; // enables the options below
+	int tickRate = 20; // ticks per second
+	int bytesPerTick = 1400; // budget per client and tick
+	float distanceWeight = 0.1f; // how much the distance between two players lowers the priority
+	float changeWeight = 1.0f; // how much the distance moved since the last sent update raises the priority
+
+	// move filter, drops moves that clients can predict from the last relayed moves
+	// clients are expected to extrapolate a player with the velocity between its last two received moves
+	// can't be combined with scheduleUpdates, the scheduler skips moves per client and the clients would predict differently
+	bool filterMoves = false; // enables the options below
+	float positionError = 0.01f; // max distance between the predicted and the real position
+	float rotationError = 0.01f; // max difference of any rotation matrix element
+	int maxRelayInterval = 1000; // ms, the latest move is relayed after this time, also if the player stopped sending, so clients never drift
+};
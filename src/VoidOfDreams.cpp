@@ -1,6 +1,7 @@
 #include "Layers/Network.h"
 
 #include <iostream>
+#include <string>
 
 #ifdef _WIN32
 #include <WinSock2.h>
@@ -28,12 +29,41 @@ void closeWSA() {
 #endif // _WIN32
 
 
-int main() {
+int main(int argc, char** argv) {
 #ifdef _WIN32
 	startWSA();
 #endif // _WIN32
 
 	NetworkData network = {};
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--low-latency")
+			network.lowLatency = true;
+		else if (arg == "--schedule")
+			network.scheduleUpdates = true;
+		else if (arg == "--simulate")
+			network.simulateInputs = true;
+		else if (arg == "--filter")
+			network.filterMoves = true;
+		else if (arg == "--handoff" && i + 1 < argc)
+			network.handoffPath = argv[++i];
+		else if (arg == "--local" && i + 1 < argc)
+			network.localPath = argv[++i];
+		else if (arg == "--takeover")
+			network.takeover = true;
+		else if (arg == "--idle-timeout" && i + 1 < argc)
+			network.idleTimeout = std::stoi(argv[++i]);
+		else if (arg == "--heartbeat" && i + 1 < argc)
+			network.heartbeatInterval = std::stoi(argv[++i]);
+		else if (arg == "--shards" && i + 1 < argc)
+			network.dgramShards = std::stoi(argv[++i]);
+		else if (arg == "--port" && i + 1 < argc)
+			network.port = argv[++i];
+		else if (arg == "--cpu" && i + 1 < argc)
+			network.cpus.push_back(std::stoi(argv[++i]));
+		else
+			fprintf(stderr, "unknown argument %s\n", arg.c_str());
+	}
 
 	runServer(network);
 